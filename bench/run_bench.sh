@@ -0,0 +1,61 @@
+#!/bin/bash
+# 编译时间 / 内存 / 生成代码规模的基准测试
+# 用法: run_bench.sh <compiler> <sysy_gen> <work_dir>
+# 对每种程序和规模分别以 -koopa 和 -riscv 编译, 结果每行一个 JSON 对象, 写到 stdout 和 <work_dir>/results.jsonl
+set -e
+
+COMPILER=$1
+GEN=$2
+WORK_DIR=$3
+if [ -z "$COMPILER" ] || [ -z "$GEN" ] || [ -z "$WORK_DIR" ]; then
+    echo "usage: $0 <compiler> <sysy_gen> <work_dir>" >&2
+    exit 1
+fi
+
+# 每种程序的规模, 可以通过环境变量覆盖
+EXPR_SIZES=${EXPR_SIZES:-"100 500 1000"}
+FUNCS_SIZES=${FUNCS_SIZES:-"100 1000 5000"}
+IFELSE_SIZES=${IFELSE_SIZES:-"100 500 1000"}
+LOOPS_SIZES=${LOOPS_SIZES:-"10 50 200"}
+GLOBALS_SIZES=${GLOBALS_SIZES:-"100 1000 5000"}
+
+mkdir -p "$WORK_DIR"
+RESULTS="$WORK_DIR/results.jsonl"
+: > "$RESULTS"
+
+# Koopa IR 中缩进的行是指令; RISC-V 中缩进且不是伪指令 (.xxx) 或注释 (#) 的行是指令
+count_insts() {
+    if [ "$1" = "-koopa" ]; then
+        grep -c '^  ' "$2" || true
+    else
+        grep -c '^  [^.#]' "$2" || true
+    fi
+}
+
+run_one() {
+    local kind=$1
+    local n=$2
+    local src="$WORK_DIR/${kind}_${n}.sy"
+    "$GEN" "$kind" "$n" > "$src"
+    for mode in -koopa -riscv; do
+        local out="$WORK_DIR/${kind}_${n}${mode/-/.}"
+        local stats
+        local line
+        # 编译失败时只记录失败, 不中断其余的测试
+        if stats=$("$COMPILER" "$mode" "$src" -o "$out" -time-passes -mem-report -stats-json 2>&1 >/dev/null); then
+            local insts
+            insts=$(count_insts "$mode" "$out")
+            line="{\"program\": \"${kind}\", \"n\": ${n}, \"mode\": \"${mode#-}\", \"insts\": ${insts}, \"stats\": ${stats}}"
+        else
+            line="{\"program\": \"${kind}\", \"n\": ${n}, \"mode\": \"${mode#-}\", \"failed\": true}"
+        fi
+        echo "$line"
+        echo "$line" >> "$RESULTS"
+    done
+}
+
+for n in $EXPR_SIZES; do run_one expr "$n"; done
+for n in $FUNCS_SIZES; do run_one funcs "$n"; done
+for n in $IFELSE_SIZES; do run_one ifelse "$n"; done
+for n in $LOOPS_SIZES; do run_one loops "$n"; done
+for n in $GLOBALS_SIZES; do run_one globals "$n"; done
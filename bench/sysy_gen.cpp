@@ -0,0 +1,131 @@
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// 生成规模可调的 SysY 程序, 用于测量编译器本身的编译时间和内存占用.
+// 用法: sysy_gen <kind> <n>
+//   expr     n 层嵌套的括号表达式
+//   funcs    n 个互相调用的函数
+//   ifelse   n 个分支的 if / else if 链
+//   loops    n 层嵌套的 while 循环
+//   globals  n 个全局变量
+
+static void GenExpr(int n)
+{
+    printf("int main()\n{\n    int a = getint();\n    int b = getint();\n    return ");
+    for (int i = 0; i < n; i++)
+    {
+        printf("(");
+    }
+    printf("a");
+    static const char *ops[] = {" + b", " * 3", " - a", " / 2", " % 97", " + 7"};
+    for (int i = 0; i < n; i++)
+    {
+        printf("%s)", ops[i % 6]);
+    }
+    printf(";\n}\n");
+}
+
+static void GenFuncs(int n)
+{
+    printf("int f0(int a, int b)\n{\n    return a + b;\n}\n\n");
+    for (int i = 1; i < n; i++)
+    {
+        printf("int f%d(int a, int b)\n{\n", i);
+        printf("    int c = a * %d + b;\n", i % 13 + 1);
+        printf("    if (c > %d)\n    {\n        c = c - %d;\n    }\n", i * 7 % 1000, i % 100);
+        printf("    return f%d(c %% 1000, b + 1);\n}\n\n", i - 1);
+    }
+    printf("int main()\n{\n    putint(f%d(getint(), 0));\n    return 0;\n}\n", n - 1);
+}
+
+static void GenIfElse(int n)
+{
+    printf("int main()\n{\n    int x = getint();\n    int r = 0;\n    ");
+    for (int i = 0; i < n; i++)
+    {
+        printf("if (x == %d)\n        r = %d;\n    else ", i, i * 3 % 17);
+    }
+    printf("\n        r = -1;\n    putint(r);\n    return 0;\n}\n");
+}
+
+static void GenLoops(int n)
+{
+    printf("int main()\n{\n    int s = 0;\n");
+    for (int i = 0; i < n; i++)
+    {
+        printf("    int i%d = 0;\n", i);
+    }
+    for (int i = 0; i < n; i++)
+    {
+        printf("%*swhile (i%d < 2)\n%*s{\n", 4 * (i + 1), "", i, 4 * (i + 1), "");
+    }
+    printf("%*ss = (s + %d) %% 10007;\n", 4 * (n + 1), "", n);
+    for (int i = n - 1; i >= 0; i--)
+    {
+        printf("%*si%d = i%d + 1;\n", 4 * (i + 2), "", i, i);
+        if (i + 1 < n)
+        {
+            printf("%*si%d = 0;\n", 4 * (i + 2), "", i + 1);
+        }
+        printf("%*s}\n", 4 * (i + 1), "");
+    }
+    printf("    putint(s);\n    return 0;\n}\n");
+}
+
+static void GenGlobals(int n)
+{
+    for (int i = 0; i < n; i++)
+    {
+        if (i % 3 == 0)
+        {
+            printf("const int c%d = %d;\n", i, i);
+        }
+        printf("int g%d = %d;\n", i, i % 251);
+    }
+    printf("\nint main()\n{\n    int s = 0;\n");
+    for (int i = 0; i < n; i++)
+    {
+        printf("    g%d = g%d + s;\n    s = (s + g%d) %% 10007;\n", i, i, i);
+    }
+    printf("    putint(s);\n    return 0;\n}\n");
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s <expr|funcs|ifelse|loops|globals> <n>\n", argv[0]);
+        return 1;
+    }
+    const char *kind = argv[1];
+    int n = atoi(argv[2]);
+    assert(n > 0);
+    if (strcmp(kind, "expr") == 0)
+    {
+        GenExpr(n);
+    }
+    else if (strcmp(kind, "funcs") == 0)
+    {
+        GenFuncs(n);
+    }
+    else if (strcmp(kind, "ifelse") == 0)
+    {
+        GenIfElse(n);
+    }
+    else if (strcmp(kind, "loops") == 0)
+    {
+        GenLoops(n);
+    }
+    else if (strcmp(kind, "globals") == 0)
+    {
+        GenGlobals(n);
+    }
+    else
+    {
+        fprintf(stderr, "unknown kind: %s\n", kind);
+        return 1;
+    }
+    return 0;
+}
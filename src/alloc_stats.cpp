@@ -0,0 +1,30 @@
+#include <cstdlib>
+#include <new>
+#include "stats.h"
+
+using namespace std;
+
+// 统计 operator new 的调用次数和字节数, 供 -mem-report 使用.
+// 单独放在一个编译单元中: 和调用者在同一个文件里时 GCC 会把它们内联,
+// 在 -O2 及以上把 new 表达式和 free 配对, 报 -Wmismatched-new-delete
+void *operator new(size_t size)
+{
+    alloc_count.fetch_add(1, memory_order_relaxed);
+    alloc_bytes.fetch_add(size, memory_order_relaxed);
+    void *ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr)
+    {
+        throw bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept
+{
+    free(ptr);
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#define ARENA_CHUNK_SIZE (1 << 20)
+
+using namespace std;
+
+// AST 节点统一从 Arena 中分配: 分配只需要移动指针, 整棵树在 Release() 时按块一次性释放.
+// Arena 不会调用析构函数, 所以从中分配的对象必须是 trivially destructible 的.
+class Arena
+{
+private:
+    vector<char *> chunks;
+    char *cur = nullptr;
+    size_t left = 0;
+public:
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    ~Arena()
+    {
+        Release();
+    }
+    void *Allocate(size_t size, size_t align)
+    {
+        size_t pad = (-reinterpret_cast<uintptr_t>(cur)) & (align - 1);
+        if (pad + size > left)
+        {
+            size_t chunk_size = max(size + align, (size_t)ARENA_CHUNK_SIZE);
+            cur = static_cast<char *>(::operator new(chunk_size));
+            chunks.push_back(cur);
+            left = chunk_size;
+            pad = (-reinterpret_cast<uintptr_t>(cur)) & (align - 1);
+        }
+        void *ptr = cur + pad;
+        cur += pad + size;
+        left -= pad + size;
+        return ptr;
+    }
+    template <typename T, typename... Args>
+    T *New(Args &&...args)
+    {
+        static_assert(is_trivially_destructible<T>::value, "arena objects are never destroyed");
+        return new (Allocate(sizeof(T), alignof(T))) T(forward<Args>(args)...);
+    }
+    const char *Strdup(const char *str)
+    {
+        size_t len = strlen(str);
+        char *copy = static_cast<char *>(Allocate(len + 1, 1));
+        memcpy(copy, str, len + 1);
+        return copy;
+    }
+    void Release()
+    {
+        for (char *chunk: chunks)
+        {
+            ::operator delete(chunk);
+        }
+        chunks.clear();
+        cur = nullptr;
+        left = 0;
+    }
+};
+
+// 子节点列表: 连续存放在 Arena 中的指针数组, 容量不足时按两倍扩容
+template <typename T>
+class ArenaVector
+{
+private:
+    T *items = nullptr;
+    uint32_t len = 0;
+    uint32_t cap = 0;
+public:
+    void push_back(Arena &arena, const T &item)
+    {
+        if (len == cap)
+        {
+            uint32_t new_cap = (cap == 0) ? 4 : cap * 2;
+            T *new_items = static_cast<T *>(arena.Allocate(sizeof(T) * new_cap, alignof(T)));
+            if (len != 0)
+            {
+                memcpy(static_cast<void *>(new_items), items, sizeof(T) * len);
+            }
+            items = new_items;
+            cap = new_cap;
+        }
+        items[len++] = item;
+    }
+    uint32_t size() const
+    {
+        return len;
+    }
+    T &operator[](uint32_t i)
+    {
+        assert(i < len);
+        return items[i];
+    }
+    T *begin()
+    {
+        return items;
+    }
+    T *end()
+    {
+        return items + len;
+    }
+};
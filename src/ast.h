@@ -1,11 +1,10 @@
 #pragma once
 #include <cassert>
-#include <memory>
 #include <string>
-#include <iostream>
-#include <map>
-#include <sstream>
 #include <vector>
+#include "arena.h"
+#include "context.h"
+#include "ir.h"
 #include "table.h"
 
 using namespace std;
@@ -45,6 +44,7 @@ class VarDefAST;
 class InitVal;
 class FuncFParamAST;
 
+enum BType{BTYPE_INT, BTYPE_VOID};
 enum PrimaryExpType{EXP, NUMBER, LVAL};
 enum UnaryExpType{PRIMARY, UNARY, CALL};
 enum BianryOPExpType{INHERIT, EXPAND};
@@ -56,40 +56,37 @@ enum OpenStmtType{OSTMT_CLOSED, OSTMT_OPEN, OSTMT_ELSE, OSTMT_WHILE};
 enum ClosedStmtType{CSTMT_SIMPLE, CSTMT_ELSE, CSTMT_WHILE};
 enum SimpleStmtType{SSTMT_ASSIGN, SSTMT_EMPTY_RET, SSTMT_RETURN, SSTMT_EMPTY_EXP, SSTMT_EXP, SSTMT_BLK, SSTMT_BREAK, SSTMT_CONTINUE};
 
-static int symbol_count = 0;
-static int label_count = 0;
-static map<string, string> names = {{"!=", "ne"}, {"==", "eq"}, {">", "gt"}, {"<", "lt"}, {">=", "ge"}, {"<=", "le"}, {"+", "add"}, {"-", "sub"}, {"*", "mul"}, {"/", "div"}, {"%", "mod"}, {"&&", "and"}, {"||", "or"}};
-static bool is_ret = false;
-static int alloc_tmp = 0;
-static vector<int> while_stack;
-static string current_func;
+static IRBasicBlock *NewLabel(const string &prefix, int id)
+{
+    return ctx->ir_builder.NewBlock(prefix + to_string(id));
+}
 
+// 所有 AST 节点都从 ast_arena 中分配, 不会被单独析构, 因此成员中不能有 string / unique_ptr
 class BaseAST
 {
 public:
-    string ident = "";
+    symbol_id_t ident = 0;
     bool is_global = false;
-    virtual void DumpIR() = 0;
-    virtual ~BaseAST() = default;
+    virtual void BuildIR() = 0;
 };
 
 class VecAST
 {
 public:
-    vector<unique_ptr<BaseAST> > vec;
-    void push_back(unique_ptr<BaseAST> &ast)
+    ArenaVector<BaseAST *> vec;
+    void push_back(BaseAST *ast)
     {
-        vec.push_back(move(ast));
+        vec.push_back(ctx->ast_arena, ast);
     }
 };
 
 class ExpVecAST
 {
 public:
-    vector<unique_ptr<BaseExpAST> > vec;
-    void push_back(unique_ptr<BaseExpAST> &ast)
+    ArenaVector<BaseExpAST *> vec;
+    void push_back(BaseExpAST *ast)
     {
-        vec.push_back(move(ast));
+        vec.push_back(ctx->ast_arena, ast);
     }
 };
 
@@ -101,123 +98,124 @@ public:
     bool is_const = false;
     bool is_evaled = false;
     bool is_left = false;
-    void Copy(unique_ptr<BaseExpAST> &exp)
+    koopa_raw_value_t ir_value = nullptr;
+    void Copy(BaseExpAST *exp)
     {
         value = exp->value;
-        ident = exp->ident;
+        ir_value = exp->ir_value;
         is_const = exp->is_const;
         is_evaled = exp->is_evaled;
     }
+    koopa_raw_value_t Operand()
+    {
+        if (is_const)
+        {
+            return ctx->ir_builder.Integer(value);
+        }
+        assert(ir_value != nullptr);
+        return ir_value;
+    }
 };
 
 class CompUnitAST : public BaseAST
 {
 public:
-    unique_ptr<VecAST> comp_units;
-    void DumpIR() override
+    VecAST *comp_units;
+    void BuildIR() override
     { 
-        symbol_table_stack.PushScope();
+        ctx->symbol_table_stack.PushScope();
         initSysyRuntimeLib();
         for (auto &item:comp_units->vec)
         {
             item->is_global = true;
-            item->DumpIR();
+            item->BuildIR();
         }
-        symbol_table_stack.PopScope();
+        ctx->symbol_table_stack.PopScope();
     }
 };
 
-class FuncDefAST : public BaseAST
+class TypeAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> func_type;
-    unique_ptr<BaseAST> block;
-    unique_ptr<VecAST> func_fparams;
-    void DumpIR() override
-    {
-        current_func = ident;
-        func_type->DumpIR();
-        symbol_count = 0;
-        assert(func_map.find(ident) == func_map.end());
-        func_map[ident] = func_type->ident;
-        symbol_table_stack.PushScope();
-        vector<string> params;
-        cout << "fun @" << ident << "(";
-        int count = 0;
-        for (auto &param: func_fparams->vec)
-        {
-            if (count != 0)
-            {
-                cout << ", ";
-            }
-            param->DumpIR();
-            params.push_back(param->ident);
-            count++;
-        }
-        cout << ")";
-        if (func_type->ident == "i32")
+    BType type;
+    koopa_raw_type_t ir_type;
+    void BuildIR() override
+    {   
+        if (type == BType::BTYPE_INT)
         {
-            cout << ": " << func_type->ident;
+            ir_type = ctx->ir_builder.I32();
         }
-        cout << " {" << endl;
-        cout << "%entry_" << ident << ":" << endl;
-        for (auto &param: params)
+        else if (type == BType::BTYPE_VOID)
         {
-            symbol_table_stack.Insert(param, "%" + param);
-            symbol_info_t *info = symbol_table_stack.LookUp(param);
-            cout << "  " << info->ir_name << " = alloc i32" << endl;
-            cout << "  store @" << param << ", " << info->ir_name << endl;
+            ir_type = ctx->ir_builder.Unit();
         }
-        block->DumpIR();
-        if (is_ret == false)
+        else
         {
-            if (func_type->ident == "i32")
-            {
-                cout << "  ret 0" << endl;
-            }
-            else if (func_type->ident == "void")
-                cout << "  ret" << endl;
+            assert(false);
         }
-        cout << "}" << endl;
-        symbol_table_stack.PopScope();
-        is_ret = false;
     }
 };
 
-class TypeAST : public BaseAST
+class FuncDefAST : public BaseAST
 {
 public:
-    string type;
-    void DumpIR() override
-    {   
-        if (type == "int")
+    TypeAST *func_type;
+    BaseAST *block;
+    VecAST *func_fparams;
+    void BuildIR() override
+    {
+        ctx->current_func = ident;
+        func_type->BuildIR();
+        assert(ctx->func_map.find(ident) == ctx->func_map.end());
+        ctx->symbol_table_stack.PushScope();
+        const char *name = ctx->symbol_pool.Name(ident);
+        vector<symbol_id_t> params;
+        vector<string> param_names;
+        for (auto &param: func_fparams->vec)
         {
-            ident = "i32";
+            param->BuildIR();
+            params.push_back(param->ident);
+            param_names.push_back(string("@") + ctx->symbol_pool.Name(param->ident));
         }
-        else if (type == "void")
+        IRFunction *func = ctx->ir_builder.DefineFunction(string("@") + name, param_names, func_type->ir_type);
+        ctx->func_map[ident] = func;
+        ctx->ir_builder.SetInsertBlock(ctx->ir_builder.NewBlock(string("%entry_") + name));
+        for (size_t i = 0; i < params.size(); i++)
         {
-            ident="void";
+            ctx->symbol_table_stack.Insert(params[i], string("%") + ctx->symbol_pool.Name(params[i]));
+            symbol_info_t *info = ctx->symbol_table_stack.LookUp(params[i]);
+            info->ir_value = ctx->ir_builder.Alloc(info->ir_name);
+            ctx->ir_builder.Store(reinterpret_cast<koopa_raw_value_t>(func->param_list[i]), info->ir_value);
         }
-        else
+        block->BuildIR();
+        if (ctx->is_ret == false)
         {
-            assert(false);
+            if (func_type->type == BType::BTYPE_INT)
+            {
+                ctx->ir_builder.Return(ctx->ir_builder.Integer(0));
+            }
+            else if (func_type->type == BType::BTYPE_VOID)
+                ctx->ir_builder.Return(nullptr);
         }
+        ctx->symbol_table_stack.PopScope();
+        ctx->is_ret = false;
     }
 };
 
+
 class BlockAST : public BaseAST
 {
 public:
-    unique_ptr<VecAST> items;
-    void DumpIR() override
+    VecAST *items;
+    void BuildIR() override
     {
         for (auto &item:items->vec)
         {  
-            if (is_ret == true)
+            if (ctx->is_ret == true)
             {
                break;
             }
-            item->DumpIR();
+            item->BuildIR();
         }
     }
 };
@@ -226,17 +224,17 @@ class StmtAST : public BaseAST
 {
 public:
     StmtType type;
-    unique_ptr<BaseAST> open_stmt;
-    unique_ptr<BaseAST> closed_stmt;
-    void DumpIR() override
+    BaseAST *open_stmt;
+    BaseAST *closed_stmt;
+    void BuildIR() override
     {
         if (type == StmtType::STMT_CLOSED)
         {
-            closed_stmt->DumpIR();
+            closed_stmt->BuildIR();
         }
         else if (type == StmtType::STMT_OPEN)
         {
-            open_stmt->DumpIR();
+            open_stmt->BuildIR();
         }
         else
         {
@@ -249,89 +247,94 @@ class OpenStmtAST: public BaseAST
 {
 public:
     OpenStmtType type;
-    unique_ptr<BaseExpAST> exp;
-    unique_ptr<BaseAST> open_stmt;
-    unique_ptr<BaseAST> closed_stmt;
-    void DumpIR() override
+    BaseExpAST *exp;
+    BaseAST *open_stmt;
+    BaseAST *closed_stmt;
+    void BuildIR() override
     {
-        string label_then = "%then_" + to_string(label_count);
-        string label_else = "%else_" + to_string(label_count);
-        string label_end = "%end_" + to_string(label_count);
-        string label_while_entry = "%while_entry_" + to_string(label_count);
-        string label_while_body = "%while_body_" + to_string(label_count++);
+        int label = ctx->label_count++;
         if (type == OpenStmtType::OSTMT_CLOSED)
         {
+            IRBasicBlock *label_then = NewLabel("%then_", label);
+            IRBasicBlock *label_end = NewLabel("%end_", label);
             exp->Eval();
-            cout << "  br " << exp->ident << ", " << label_then << ", " << label_end << endl << endl;
-            cout << label_then << ":" << endl;
-            is_ret = false;
-            closed_stmt->DumpIR();
-            if (is_ret == false)
+            ctx->ir_builder.Branch(exp->Operand(), label_then, label_end);
+            ctx->ir_builder.SetInsertBlock(label_then);
+            ctx->is_ret = false;
+            closed_stmt->BuildIR();
+            if (ctx->is_ret == false)
             {
-                cout << "  jump " << label_end << endl;
+                ctx->ir_builder.Jump(label_end);
             }
-            cout << endl << label_end << ":" << endl;
-            is_ret = false;
+            ctx->ir_builder.SetInsertBlock(label_end);
+            ctx->is_ret = false;
         }
         else if (type == OpenStmtType::OSTMT_OPEN)
         {
+            IRBasicBlock *label_then = NewLabel("%then_", label);
+            IRBasicBlock *label_end = NewLabel("%end_", label);
             exp->Eval();
-            cout << "  br " << exp->ident << ", " << label_then << ", " << label_end << endl << endl;
-            cout << label_then << ":" << endl;
-            is_ret = false;
-            open_stmt->DumpIR();
-            if (is_ret == false)
+            ctx->ir_builder.Branch(exp->Operand(), label_then, label_end);
+            ctx->ir_builder.SetInsertBlock(label_then);
+            ctx->is_ret = false;
+            open_stmt->BuildIR();
+            if (ctx->is_ret == false)
             {
-                cout << "  jump " << label_end << endl;
+                ctx->ir_builder.Jump(label_end);
             }
-            cout << endl << label_end << ":" << endl;
-            is_ret = false;
+            ctx->ir_builder.SetInsertBlock(label_end);
+            ctx->is_ret = false;
         }
         else if (type == OpenStmtType::OSTMT_ELSE)
         {
+            IRBasicBlock *label_then = NewLabel("%then_", label);
+            IRBasicBlock *label_else = NewLabel("%else_", label);
+            IRBasicBlock *label_end = NewLabel("%end_", label);
             bool total_ret = true;
             exp->Eval();
-            cout << "  br " << exp->ident << ", " << label_then << ", " << label_else << endl << endl;
-            cout << label_then << ":" << endl;
-            is_ret = false;
-            closed_stmt->DumpIR();
-            total_ret = total_ret & is_ret;
-            if (is_ret == false)
+            ctx->ir_builder.Branch(exp->Operand(), label_then, label_else);
+            ctx->ir_builder.SetInsertBlock(label_then);
+            ctx->is_ret = false;
+            closed_stmt->BuildIR();
+            total_ret = total_ret & ctx->is_ret;
+            if (ctx->is_ret == false)
             {
-                cout << "  jump " << label_end << endl;
+                ctx->ir_builder.Jump(label_end);
             }
-            cout << endl << label_else << ":" << endl;
-            is_ret = false;
-            open_stmt->DumpIR();
-            total_ret = total_ret & is_ret;
-            if (is_ret == false)
+            ctx->ir_builder.SetInsertBlock(label_else);
+            ctx->is_ret = false;
+            open_stmt->BuildIR();
+            total_ret = total_ret & ctx->is_ret;
+            if (ctx->is_ret == false)
             {
-                cout << "  jump " << label_end << endl;
+                ctx->ir_builder.Jump(label_end);
             }
-            cout << endl;
             if (total_ret == false)
             {
-                cout << label_end << ":" << endl;
+                ctx->ir_builder.SetInsertBlock(label_end);
             }
-            is_ret = total_ret;
+            ctx->is_ret = total_ret;
         }
         else if (type == OpenStmtType::OSTMT_WHILE)
         {
-            while_stack.push_back(label_count - 1);
-            cout << "  jump " << label_while_entry << endl << endl;
-            cout << label_while_entry << ":" << endl;
+            IRBasicBlock *label_while_entry = NewLabel("%while_entry_", label);
+            IRBasicBlock *label_while_body = NewLabel("%while_body_", label);
+            IRBasicBlock *label_end = NewLabel("%end_", label);
+            ctx->while_stack.push_back({label_while_entry, label_end});
+            ctx->ir_builder.Jump(label_while_entry);
+            ctx->ir_builder.SetInsertBlock(label_while_entry);
             exp->Eval();
-            cout << "  br " << exp->ident << ", " << label_while_body << ", " << label_end << endl << endl;
-            cout << label_while_body << ":" << endl;
-            is_ret = false;
-            open_stmt->DumpIR();
-            if (is_ret == false)
+            ctx->ir_builder.Branch(exp->Operand(), label_while_body, label_end);
+            ctx->ir_builder.SetInsertBlock(label_while_body);
+            ctx->is_ret = false;
+            open_stmt->BuildIR();
+            if (ctx->is_ret == false)
             {
-                cout << "  jump " << label_while_entry << endl;
+                ctx->ir_builder.Jump(label_while_entry);
             }
-            cout << endl << label_end << ":" << endl;
-            is_ret = false;
-            while_stack.pop_back();
+            ctx->ir_builder.SetInsertBlock(label_end);
+            ctx->is_ret = false;
+            ctx->while_stack.pop_back();
         }
         else
         {
@@ -344,68 +347,68 @@ class ClosedStmtAST: public BaseAST
 {
 public:
     ClosedStmtType type;
-    unique_ptr<BaseExpAST> exp;
-    unique_ptr<BaseAST> closed_stmt1;
-    unique_ptr<BaseAST> closed_stmt2;
-    unique_ptr<BaseAST> simple_stmt;
-    void DumpIR() override
+    BaseExpAST *exp;
+    BaseAST *closed_stmt1;
+    BaseAST *closed_stmt2;
+    BaseAST *simple_stmt;
+    void BuildIR() override
     {
         if (type == ClosedStmtType::CSTMT_SIMPLE)
         {
-            simple_stmt->DumpIR();
+            simple_stmt->BuildIR();
         }
         else if (type == ClosedStmtType::CSTMT_ELSE)
         {
-            string label_then = "%then_" + to_string(label_count);
-            string label_else = "%else_" + to_string(label_count);
-            string label_end = "%end_" + to_string(label_count++);
+            int label = ctx->label_count++;
+            IRBasicBlock *label_then = NewLabel("%then_", label);
+            IRBasicBlock *label_else = NewLabel("%else_", label);
+            IRBasicBlock *label_end = NewLabel("%end_", label);
             bool total_ret = true;
             exp->Eval();
-            cout << "  br " << exp->ident << ", " << label_then << ", " << label_else << endl << endl;
-            cout << label_then << ":" << endl;
-            is_ret = false;
-            closed_stmt1->DumpIR();
-            total_ret = total_ret & is_ret;
-            if (is_ret == false)
+            ctx->ir_builder.Branch(exp->Operand(), label_then, label_else);
+            ctx->ir_builder.SetInsertBlock(label_then);
+            ctx->is_ret = false;
+            closed_stmt1->BuildIR();
+            total_ret = total_ret & ctx->is_ret;
+            if (ctx->is_ret == false)
             {
-                cout << "  jump " << label_end << endl;
+                ctx->ir_builder.Jump(label_end);
             }
-            cout << endl << label_else << ":" << endl;
-            is_ret = false;
-            closed_stmt2->DumpIR();
-            total_ret = total_ret & is_ret;
-            if (is_ret == false)
+            ctx->ir_builder.SetInsertBlock(label_else);
+            ctx->is_ret = false;
+            closed_stmt2->BuildIR();
+            total_ret = total_ret & ctx->is_ret;
+            if (ctx->is_ret == false)
             {
-                cout << "  jump " << label_end << endl;
+                ctx->ir_builder.Jump(label_end);
             }
-            cout << endl;
             if (total_ret == false)
             {
-                cout << label_end << ":" << endl;
+                ctx->ir_builder.SetInsertBlock(label_end);
             }
-            is_ret = total_ret;
+            ctx->is_ret = total_ret;
         }
         else if (type == ClosedStmtType::CSTMT_WHILE)
         {
-            string label_end = "%end_" + to_string(label_count);
-            string label_while_entry = "%while_entry_" + to_string(label_count);
-            string label_while_body = "%while_body_" + to_string(label_count);
-            while_stack.push_back(label_count++);
-            cout << "  jump " << label_while_entry << endl << endl;
-            cout << label_while_entry << ":" << endl;
+            int label = ctx->label_count++;
+            IRBasicBlock *label_while_entry = NewLabel("%while_entry_", label);
+            IRBasicBlock *label_while_body = NewLabel("%while_body_", label);
+            IRBasicBlock *label_end = NewLabel("%end_", label);
+            ctx->while_stack.push_back({label_while_entry, label_end});
+            ctx->ir_builder.Jump(label_while_entry);
+            ctx->ir_builder.SetInsertBlock(label_while_entry);
             exp->Eval();
-            cout << "  br " << exp->ident << ", " << label_while_body << ", " << label_end << endl << endl;
-            cout << label_while_body << ":" << endl;
-            is_ret = false;
-            closed_stmt1->DumpIR();
-            if (is_ret == false)
+            ctx->ir_builder.Branch(exp->Operand(), label_while_body, label_end);
+            ctx->ir_builder.SetInsertBlock(label_while_body);
+            ctx->is_ret = false;
+            closed_stmt1->BuildIR();
+            if (ctx->is_ret == false)
             {
-                cout << "  jump " << label_while_entry << endl;
+                ctx->ir_builder.Jump(label_while_entry);
             }
-            cout << endl;
-            cout << label_end << ":" << endl;
-            is_ret = false;
-            while_stack.pop_back();
+            ctx->ir_builder.SetInsertBlock(label_end);
+            ctx->is_ret = false;
+            ctx->while_stack.pop_back();
         }
         else
         {
@@ -418,29 +421,29 @@ class SimpleStmtAST : public BaseAST
 {
 public:
     SimpleStmtType type;
-    unique_ptr<BaseExpAST> lval;
-    unique_ptr<BaseExpAST> exp;
-    unique_ptr<BaseAST> block;
-    void DumpIR() override
+    BaseExpAST *lval;
+    BaseExpAST *exp;
+    BaseAST *block;
+    void BuildIR() override
     {
         if (type == SimpleStmtType::SSTMT_RETURN)
         {
             exp->Eval();
-            cout << "  ret " << exp->ident << endl;
-            is_ret = true;
+            ctx->ir_builder.Return(exp->Operand());
+            ctx->is_ret = true;
         }
         else if (type == SimpleStmtType::SSTMT_EMPTY_RET)
         {
-            string ret_type = func_map[current_func];
-            if (ret_type == "i32")
+            koopa_raw_function_t func = ctx->func_map[ctx->current_func];
+            if (func->ty->data.function.ret->tag == KOOPA_RTT_INT32)
             {
-                cout << "  ret 0" << endl;
+                ctx->ir_builder.Return(ctx->ir_builder.Integer(0));
             }
             else
             {
-                cout << "  ret" << endl;
+                ctx->ir_builder.Return(nullptr);
             }
-            is_ret = true;
+            ctx->is_ret = true;
         }
         else if (type == SimpleStmtType::SSTMT_ASSIGN)
         {
@@ -448,15 +451,15 @@ public:
             lval->is_left = true;
             lval->Eval();
             assert(!lval->is_const);
-            exp->DumpIR();
-            symbol_info_t *info = symbol_table_stack.LookUp(lval->ident);
-            cout << "  store " << exp->ident << ", " << info->ir_name << endl;
+            exp->BuildIR();
+            symbol_info_t *info = ctx->symbol_table_stack.LookUp(lval->ident);
+            ctx->ir_builder.Store(exp->Operand(), info->ir_value);
         }
         else if (type == SimpleStmtType::SSTMT_BLK)
         {
-            symbol_table_stack.PushScope();
-            block->DumpIR();
-            symbol_table_stack.PopScope();
+            ctx->symbol_table_stack.PushScope();
+            block->BuildIR();
+            ctx->symbol_table_stack.PopScope();
         }
         else if (type == SimpleStmtType::SSTMT_EMPTY_EXP)
         {
@@ -464,21 +467,19 @@ public:
         else if (type == SimpleStmtType::SSTMT_EXP)
         {
             exp->Eval();
-            exp->DumpIR();
+            exp->BuildIR();
         }
         else if (type == SimpleStmtType::SSTMT_BREAK)
         {
-            assert(!while_stack.empty());
-            int label_num = while_stack.back();
-            cout << "  jump %end_" << to_string(label_num) << endl << endl;
-            is_ret = true;
+            assert(!ctx->while_stack.empty());
+            ctx->ir_builder.Jump(ctx->while_stack.back().end);
+            ctx->is_ret = true;
         }
         else if (type == SimpleStmtType::SSTMT_CONTINUE)
         {
-            assert(!while_stack.empty());
-            int label_num = while_stack.back();
-            cout << "  jump %while_entry_" << to_string(label_num) << endl << endl;
-            is_ret = true;
+            assert(!ctx->while_stack.empty());
+            ctx->ir_builder.Jump(ctx->while_stack.back().entry);
+            ctx->is_ret = true;
         }
         else
         {
@@ -490,10 +491,10 @@ public:
 class ExpAST : public BaseExpAST
 {
 public:
-    unique_ptr<BaseExpAST> exp;
-    void DumpIR() override
+    BaseExpAST *exp;
+    void BuildIR() override
     {
-        exp->DumpIR();
+        exp->BuildIR();
     }
     void Eval() override
     {
@@ -512,9 +513,9 @@ class PrimaryExpAST : public BaseExpAST
 public:
     PrimaryExpType type;
     int num;
-    unique_ptr<BaseExpAST> exp;
-    unique_ptr<BaseExpAST> lval;
-    void DumpIR() override
+    BaseExpAST *exp;
+    BaseExpAST *lval;
+    void BuildIR() override
     {
     }
     void Eval() override
@@ -532,7 +533,6 @@ public:
         {
             value = num;
             is_const = true;
-            ident = to_string(value);
         }
         else if (type == PrimaryExpType::LVAL)
         {
@@ -551,12 +551,12 @@ class UnaryExpAST : public BaseExpAST
 {
 public:
     UnaryExpType type;
-    unique_ptr<BaseExpAST> unary_exp;
-    unique_ptr<BaseExpAST> primary_exp;
-    unique_ptr<ExpVecAST> func_rparams;
-    string op;
-    string func_name;
-    void DumpIR() override
+    BaseExpAST *unary_exp;
+    BaseExpAST *primary_exp;
+    ExpVecAST *func_rparams;
+    char op;
+    symbol_id_t func_name;
+    void BuildIR() override
     {
     }
     void Eval() override
@@ -576,15 +576,15 @@ public:
             Copy(unary_exp);
             if (unary_exp->is_const)
             {
-                if (op == "+")
+                if (op == '+')
                 {
                     value = unary_exp->value;
                 }
-                else if (op == "-")
+                else if (op == '-')
                 {
                     value = -unary_exp->value;
                 }
-                else if (op == "!")
+                else if (op == '!')
                 {
                     value = !unary_exp->value;
                 }
@@ -592,19 +592,16 @@ public:
                 {
                     assert(false);
                 }
-                ident = to_string(value);
             }
             else
             {   
-                if (op == "-")
+                if (op == '-')
                 {
-                    ident = "%" + to_string(symbol_count++);
-                    cout << "  " << ident << " = sub 0, " << unary_exp->ident << endl;
+                    ir_value = ctx->ir_builder.Binary(KOOPA_RBO_SUB, ctx->ir_builder.Integer(0), unary_exp->Operand());
                 }
-                else if (op == "!")
+                else if (op == '!')
                 {
-                    ident = "%" + to_string(symbol_count++);
-                    cout << "  " << ident << " = eq " << unary_exp->ident << ", 0" << endl;
+                    ir_value = ctx->ir_builder.Binary(KOOPA_RBO_EQ, unary_exp->Operand(), ctx->ir_builder.Integer(0));
                 }
             }
             is_evaled = true;
@@ -615,33 +612,14 @@ public:
             {
                 param->Eval();
             }
-            assert(func_map.find(func_name) != func_map.end());
-            string ret_type = func_map[func_name];
-            if (ret_type == "i32")
-            {
-                ident = "%" + to_string(symbol_count++);
-                cout << "  " << ident << " = ";
-            }
-            else if (ret_type == "void")
-            {
-                cout << "  ";
-            }
-            else
-            {
-                assert(false);
-            }
-            cout << "call @" << func_name << "(";
-            int count = 0;
+            assert(ctx->func_map.find(func_name) != ctx->func_map.end());
+            vector<koopa_raw_value_t> args;
             for (auto &param : func_rparams->vec)
             {
-                if (count != 0)
-                {
-                    cout << ", ";
-                }
-                cout << param->ident;
-                count++;
+                args.push_back(param->Operand());
             }
-            cout << ")" << endl;
+            ir_value = ctx->ir_builder.Call(ctx->func_map[func_name], args);
+            is_evaled = true;
         }
     }
 };
@@ -650,10 +628,10 @@ class MulExpAST : public BaseExpAST
 {
 public:
     BianryOPExpType type;
-    unique_ptr<BaseExpAST> mul_exp;
-    unique_ptr<BaseExpAST> unary_exp;
-    string op;
-    void DumpIR() override
+    BaseExpAST *mul_exp;
+    BaseExpAST *unary_exp;
+    koopa_raw_binary_op_t op;
+    void BuildIR() override
     {
     }
     void Eval() override
@@ -676,15 +654,15 @@ public:
             {
                 int val1 = mul_exp->value;
                 int val2 = unary_exp->value;
-                if (op == "*")
+                if (op == KOOPA_RBO_MUL)
                 {
                     value = val1 * val2;
                 }
-                else if (op == "/")
+                else if (op == KOOPA_RBO_DIV)
                 {
                     value = val1 / val2;
                 }
-                else if (op == "%")
+                else if (op == KOOPA_RBO_MOD)
                 {
                     value = val1 % val2;
                 }
@@ -692,12 +670,10 @@ public:
                 {
                     assert(false);
                 }
-                ident = to_string(value);
             }
             else
             {
-                ident = "%" + to_string(symbol_count++);
-                cout << "  " << ident << " = " << names[op] << " " << mul_exp->ident << ", " << unary_exp->ident << endl;
+                ir_value = ctx->ir_builder.Binary(op, mul_exp->Operand(), unary_exp->Operand());
             }
         }
         else
@@ -712,10 +688,10 @@ class AddExpAST : public BaseExpAST
 {
 public:
     BianryOPExpType type;
-    unique_ptr<BaseExpAST> add_exp;
-    unique_ptr<BaseExpAST> mul_exp;
-    string op;
-    void DumpIR() override
+    BaseExpAST *add_exp;
+    BaseExpAST *mul_exp;
+    koopa_raw_binary_op_t op;
+    void BuildIR() override
     {
     }
     void Eval() override
@@ -738,11 +714,11 @@ public:
             {
                 int val1 = add_exp->value;
                 int val2 = mul_exp->value;
-                if (op == "+")
+                if (op == KOOPA_RBO_ADD)
                 {
                     value = val1 + val2;
                 }
-                else if (op == "-")
+                else if (op == KOOPA_RBO_SUB)
                 {
                     value = val1 - val2;
                 }
@@ -750,12 +726,10 @@ public:
                 {
                     assert(false);
                 }
-                ident = to_string(value);
             }
             else
             {
-                ident = "%" + to_string(symbol_count++);
-                cout << "  " << ident << " = " << names[op] << " " << add_exp->ident << ", " << mul_exp->ident << endl;
+                ir_value = ctx->ir_builder.Binary(op, add_exp->Operand(), mul_exp->Operand());
             }
         }
         else
@@ -770,10 +744,10 @@ class RelExpAST : public BaseExpAST
 {
 public:
     BianryOPExpType type;
-    unique_ptr<BaseExpAST> rel_exp;
-    unique_ptr<BaseExpAST> add_exp;
-    string op;
-    void DumpIR() override
+    BaseExpAST *rel_exp;
+    BaseExpAST *add_exp;
+    koopa_raw_binary_op_t op;
+    void BuildIR() override
     {
     }
     void Eval() override
@@ -796,19 +770,19 @@ public:
             {
                 int val1 = rel_exp->value;
                 int val2 = add_exp->value;
-                if (op == "<")
+                if (op == KOOPA_RBO_LT)
                 {
                     value = (val1 < val2);
                 }
-                else if (op == ">")
+                else if (op == KOOPA_RBO_GT)
                 {
                     value = (val1 > val2);
                 }
-                else if (op == "<=")
+                else if (op == KOOPA_RBO_LE)
                 {
                     value = (val1 <= val2);
                 }
-                else if (op == ">=")
+                else if (op == KOOPA_RBO_GE)
                 {
                     value = (val1 >= val2);
                 }
@@ -816,12 +790,10 @@ public:
                 {
                     assert(false);
                 }
-                ident = to_string(value);
             }
             else
             {
-                ident = "%" + to_string(symbol_count++);
-                cout << "  " << ident << " = " << names[op] << " " << rel_exp->ident << ", " << add_exp->ident << endl;
+                ir_value = ctx->ir_builder.Binary(op, rel_exp->Operand(), add_exp->Operand());
             }
         }
         else
@@ -836,10 +808,10 @@ class EqExpAST : public BaseExpAST
 {
 public:
     BianryOPExpType type;
-    unique_ptr<BaseExpAST> eq_exp;
-    unique_ptr<BaseExpAST> rel_exp;
-    string op;
-    void DumpIR()override
+    BaseExpAST *eq_exp;
+    BaseExpAST *rel_exp;
+    koopa_raw_binary_op_t op;
+    void BuildIR()override
     {
     }
     void Eval() override
@@ -862,11 +834,11 @@ public:
             {
                 int val1 = eq_exp->value;
                 int val2 = rel_exp->value;
-                if (op == "==")
+                if (op == KOOPA_RBO_EQ)
                 {
                     value = (val1 == val2);
                 }
-                else if (op == "!=")
+                else if (op == KOOPA_RBO_NOT_EQ)
                 {
                     value = (val1 != val2);
                 }
@@ -874,12 +846,10 @@ public:
                 {
                     assert(false);
                 }
-                ident = to_string(value);
             }
             else
             {
-                ident = "%" + to_string(symbol_count++);
-                cout << "  " << ident << " = " << names[op] << " " << eq_exp->ident << ", " << rel_exp->ident << endl;
+                ir_value = ctx->ir_builder.Binary(op, eq_exp->Operand(), rel_exp->Operand());
             }
         }
         else
@@ -894,9 +864,9 @@ class LAndExpAST : public BaseExpAST
 {
 public:
     BianryOPExpType type;
-    unique_ptr<BaseExpAST> land_exp;
-    unique_ptr<BaseExpAST> eq_exp;
-    void DumpIR() override
+    BaseExpAST *land_exp;
+    BaseExpAST *eq_exp;
+    void BuildIR() override
     {
     }
     void Eval() override
@@ -916,37 +886,30 @@ public:
             if (land_exp->is_const && land_exp->value == 0)
             {
                 value = land_exp->value;
-                ident = to_string(value);
                 is_const = true;
                 is_evaled = true;
                 return;
             }
-            string label_then = "%then_" + to_string(label_count);
-            string label_else = "%else_" + to_string(label_count);
-            string label_end = "%end_" + to_string(label_count++);
-            ident = "t" + to_string(alloc_tmp++);
-            string ir_name = "@" + ident;
-            symbol_table_stack.Insert(ident, ir_name);
-            cout << "  " << ir_name << " = alloc i32" << endl;
-            string tmp_var1 = "%" + to_string(symbol_count++);
-            cout << "  " << tmp_var1 << " = ne " << land_exp->ident << ", 0" << endl;
-            cout << "  br " << tmp_var1 << ", " << label_then << ", " << label_else << endl << endl;
-            cout << label_then << ":" << endl;
+            int label = ctx->label_count++;
+            IRBasicBlock *label_then = NewLabel("%then_", label);
+            IRBasicBlock *label_else = NewLabel("%else_", label);
+            IRBasicBlock *label_end = NewLabel("%end_", label);
+            koopa_raw_value_t tmp = ctx->ir_builder.Alloc("@t" + to_string(ctx->alloc_tmp++));
+            koopa_raw_value_t tmp_var1 = ctx->ir_builder.Binary(KOOPA_RBO_NOT_EQ, land_exp->Operand(), ctx->ir_builder.Integer(0));
+            ctx->ir_builder.Branch(tmp_var1, label_then, label_else);
+            ctx->ir_builder.SetInsertBlock(label_then);
             eq_exp->Eval();
-            string tmp_var2 = "%" + to_string(symbol_count++);
-            cout << "  " << tmp_var2 << " = ne " << eq_exp->ident << ", 0" << endl;
-            cout << "  store " << tmp_var2 << ", " << ir_name << endl;
-            cout << "  jump " << label_end << endl << endl;
-            cout << label_else << ":" << endl;
-            cout << "  store 0, " << ir_name << endl;
-            cout << "  jump " << label_end << endl << endl;
-            cout << label_end << ":" << endl;
-            ident = "%" + to_string(symbol_count++);
-            cout << "  " << ident << " = load " << ir_name << endl;
+            koopa_raw_value_t tmp_var2 = ctx->ir_builder.Binary(KOOPA_RBO_NOT_EQ, eq_exp->Operand(), ctx->ir_builder.Integer(0));
+            ctx->ir_builder.Store(tmp_var2, tmp);
+            ctx->ir_builder.Jump(label_end);
+            ctx->ir_builder.SetInsertBlock(label_else);
+            ctx->ir_builder.Store(ctx->ir_builder.Integer(0), tmp);
+            ctx->ir_builder.Jump(label_end);
+            ctx->ir_builder.SetInsertBlock(label_end);
+            ir_value = ctx->ir_builder.Load(tmp);
             if (land_exp->is_const && eq_exp->is_const)
             {
                 value = land_exp->value && eq_exp->value;
-                ident = to_string(value);
                 is_const = true;
             }
         }
@@ -962,9 +925,9 @@ class LOrExpAST : public BaseExpAST
 {
 public:
     BianryOPExpType type;
-    unique_ptr<BaseExpAST> lor_exp;
-    unique_ptr<BaseExpAST> land_exp;
-    void DumpIR() override
+    BaseExpAST *lor_exp;
+    BaseExpAST *land_exp;
+    void BuildIR() override
     {
     }
     void Eval() override
@@ -984,36 +947,30 @@ public:
             if (lor_exp->is_const && lor_exp->value == 1)
             {
                 value = lor_exp->value;
-                ident = to_string(value);
                 is_const = true;
                 is_evaled = true;
                 return;
             }
-            string label_then = "%then_" + to_string(label_count);
-            string label_else = "%else_" + to_string(label_count);
-            string label_end = "%end_" + to_string(label_count++);
-            string ir_name = "@t" + to_string(alloc_tmp++);
-            symbol_table_stack.Insert(ident, ir_name);
-            cout << "  " << ir_name << " = alloc i32" << endl;
-            string tmp_var1 = "%" + to_string(symbol_count++);
-            cout << "  " << tmp_var1 << " = eq " << lor_exp->ident << ", 0" << endl;
-            cout << "  br " << tmp_var1 << ", " << label_then << ", " << label_else << endl << endl;
-            cout << label_then << ":" << endl;
+            int label = ctx->label_count++;
+            IRBasicBlock *label_then = NewLabel("%then_", label);
+            IRBasicBlock *label_else = NewLabel("%else_", label);
+            IRBasicBlock *label_end = NewLabel("%end_", label);
+            koopa_raw_value_t tmp = ctx->ir_builder.Alloc("@t" + to_string(ctx->alloc_tmp++));
+            koopa_raw_value_t tmp_var1 = ctx->ir_builder.Binary(KOOPA_RBO_EQ, lor_exp->Operand(), ctx->ir_builder.Integer(0));
+            ctx->ir_builder.Branch(tmp_var1, label_then, label_else);
+            ctx->ir_builder.SetInsertBlock(label_then);
             land_exp->Eval();
-            string tmp_var2 = "%" + to_string(symbol_count++);
-            cout << "  " << tmp_var2 << " = ne " << land_exp->ident << ", 0" << endl;
-            cout << "  store " << tmp_var2 << ", " << ir_name << endl;
-            cout << "  jump " << label_end << endl << endl;
-            cout << label_else << ":" << endl;
-            cout << "  store 1, " << ir_name << endl;
-            cout << "  jump " << label_end << endl << endl;
-            cout << label_end << ":" << endl;
-            ident = "%" + to_string(symbol_count++);
-            cout << "  " << ident << " = load " << ir_name << endl;
+            koopa_raw_value_t tmp_var2 = ctx->ir_builder.Binary(KOOPA_RBO_NOT_EQ, land_exp->Operand(), ctx->ir_builder.Integer(0));
+            ctx->ir_builder.Store(tmp_var2, tmp);
+            ctx->ir_builder.Jump(label_end);
+            ctx->ir_builder.SetInsertBlock(label_else);
+            ctx->ir_builder.Store(ctx->ir_builder.Integer(1), tmp);
+            ctx->ir_builder.Jump(label_end);
+            ctx->ir_builder.SetInsertBlock(label_end);
+            ir_value = ctx->ir_builder.Load(tmp);
             if (land_exp->is_const && lor_exp->is_const)
             {
                 value = land_exp->value || lor_exp->value;
-                ident = to_string(value);
                 is_const = true;
             }
         }
@@ -1029,19 +986,19 @@ class DeclAST: public BaseAST
 {
 public:
     DeclType type;
-    unique_ptr<BaseAST> const_decl;
-    unique_ptr<BaseAST> var_decl;
-    void DumpIR() override
+    BaseAST *const_decl;
+    BaseAST *var_decl;
+    void BuildIR() override
     {
         if (type == DeclType::CONST_DECL)
         {
             const_decl->is_global = is_global;
-            const_decl->DumpIR();
+            const_decl->BuildIR();
         }
         else if (type == DeclType::VAR_DECL)
         {
             var_decl->is_global = is_global;
-            var_decl->DumpIR();
+            var_decl->BuildIR();
         }
         else{
             assert(false);
@@ -1052,14 +1009,14 @@ public:
 class ConstDeclAST : public BaseAST
 {
 public:
-    unique_ptr<BaseAST> btype;
-    unique_ptr<VecAST> const_defs;
-    void DumpIR() override
+    BaseAST *btype;
+    VecAST *const_defs;
+    void BuildIR() override
     {
         for (auto &def: const_defs->vec)
         {
             def->is_global = is_global;
-            def->DumpIR();
+            def->BuildIR();
         }
     }
 };
@@ -1067,19 +1024,19 @@ public:
 class ConstDefAST: public BaseAST
 {
 public:
-    unique_ptr<BaseExpAST> const_init_val;
-    void DumpIR() override
+    BaseExpAST *const_init_val;
+    void BuildIR() override
     {
         const_init_val->Eval();
-        symbol_table_stack.Insert(ident, const_init_val->value);
+        ctx->symbol_table_stack.Insert(ident, const_init_val->value);
     }
 };
 
 class ConstInitValAST : public BaseExpAST
 {
 public:
-    unique_ptr<BaseExpAST> const_exp;
-    void DumpIR() override
+    BaseExpAST *const_exp;
+    void BuildIR() override
     {
     }
     void Eval() override
@@ -1098,17 +1055,17 @@ class BlockItemAST : public BaseAST
 {
 public:
     BlockItemType type;
-    unique_ptr<BaseAST> decl;
-    unique_ptr<BaseAST> stmt;
-    void DumpIR() override
+    BaseAST *decl;
+    BaseAST *stmt;
+    void BuildIR() override
     {
         if (type == BlockItemType::BLK_DECL)
         {
-            decl->DumpIR();
+            decl->BuildIR();
         }
         else if (type == BlockItemType::BLK_STMT)
         {
-            stmt->DumpIR();
+            stmt->BuildIR();
         }
     }
 };
@@ -1116,7 +1073,7 @@ public:
 class LValAST : public BaseExpAST
 {
 public:
-    void DumpIR() override
+    void BuildIR() override
     {
     }
     void Eval() override
@@ -1125,20 +1082,18 @@ public:
         {
             return;
         }
-        symbol_info_t *info = symbol_table_stack.LookUp(ident);
+        symbol_info_t *info = ctx->symbol_table_stack.LookUp(ident);
         assert(info != nullptr);
         if (!is_left)
         {
             if (info->type == SYMBOL_TYPE::CONST_SYMBOL)
             {
                 value = info->value;
-                ident = to_string(value);
                 is_const = true;
             }
             else if (info->type == SYMBOL_TYPE::VAR_SYMBOL)
             {
-                ident = "%" + to_string(symbol_count++);
-                cout << "  " << ident << " = load " << info->ir_name << endl;
+                ir_value = ctx->ir_builder.Load(info->ir_value);
             }
         }
         is_evaled = true;
@@ -1148,8 +1103,8 @@ public:
 class ConstExpAST : public BaseExpAST
 {
 public:
-    unique_ptr<BaseExpAST> exp;
-    void DumpIR() override
+    BaseExpAST *exp;
+    void BuildIR() override
     {
     }
     void Eval() override
@@ -1167,14 +1122,14 @@ public:
 class VarDeclAST: public BaseAST
 {
 public:
-    unique_ptr<BaseAST> btype;
-    unique_ptr<VecAST> var_defs;
-    void DumpIR() override
+    BaseAST *btype;
+    VecAST *var_defs;
+    void BuildIR() override
     {
         for (auto &def: var_defs->vec)
         {
             def->is_global = is_global;
-            def->DumpIR();
+            def->BuildIR();
         }
     }
 };
@@ -1183,41 +1138,34 @@ class VarDefAST: public BaseAST
 {
 public:
     VarDefType type;
-    unique_ptr<BaseExpAST> init_val;
-    void DumpIR() override
+    BaseExpAST *init_val;
+    void BuildIR() override
     {
+        string ir_name = string("@") + ctx->symbol_pool.Name(ident);
+        ir_name = ctx->symbol_table_stack.Insert(ident, ir_name);
+        symbol_info_t *info = ctx->symbol_table_stack.LookUp(ident);
         if (is_global)
         {
-            cout << "global ";
-        }
-        string ir_name = "@" + ident;
-        ir_name = symbol_table_stack.Insert(ident, ir_name);
-        if (!is_global)
-        {
-            cout << "  ";
-        }
-        cout << ir_name << " = alloc i32";
-        if (!is_global)
-        {
-            cout << endl;
-        }
-        if (type == VarDefType::VAR_ASSIGN)
-        {
-            init_val->Eval();
-            if (is_global)
+            koopa_raw_value_t init;
+            if (type == VarDefType::VAR_ASSIGN)
             {
-                cout << ", " << init_val->ident << endl;
+                init_val->Eval();
+                assert(init_val->is_const);
+                init = init_val->Operand();
             }
             else
             {
-                cout << "  " << "store " << init_val->ident << ", " << ir_name << endl;
+                init = ctx->ir_builder.ZeroInit();
             }
+            info->ir_value = ctx->ir_builder.GlobalAlloc(ir_name, init);
         }
         else
         {
-            if (is_global)
+            info->ir_value = ctx->ir_builder.Alloc(ir_name);
+            if (type == VarDefType::VAR_ASSIGN)
             {
-                cout << ", zeroinit" << endl;
+                init_val->Eval();
+                ctx->ir_builder.Store(init_val->Operand(), info->ir_value);
             }
         }
     }
@@ -1226,8 +1174,8 @@ public:
 class InitValAST: public BaseExpAST
 {
 public:
-    std::unique_ptr<BaseExpAST> exp;
-    void DumpIR() override
+    BaseExpAST *exp;
+    void BuildIR() override
     {
     }
     void Eval() override
@@ -1245,10 +1193,9 @@ public:
 class FuncFParamAST: public BaseAST
 {
 public:
-    std::unique_ptr<BaseAST> btype;
-    void DumpIR() override
+    BaseAST *btype;
+    void BuildIR() override
     {
-        btype->DumpIR();
-        std::cout << "@" << ident << ": " << btype->ident;
+        btype->BuildIR();
     }
 };
\ No newline at end of file
@@ -0,0 +1,289 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include "ir.h"
+#include "koopa.h"
+
+using namespace std;
+
+// Finish() 之前 IR 上的控制流图和支配关系, 以及 SSA 形式下维护块参数的工具函数.
+// 构建控制流图时把每个基本块的 index 设为它在 bb_list 中的位置, 之后的分析都以这个编号为下标.
+// 支配树用 Cooper, Harvey, Kennedy 的迭代算法计算, 同样的代码在反向的图上就得到后支配树.
+
+class IRCfg
+{
+public:
+    vector<IRBasicBlock *> blocks;
+    vector<vector<int> > succs;
+    vector<vector<int> > preds;
+
+    IRCfg(IRFunction *func)
+    {
+        for (size_t i = 0; i < func->bb_list.size(); i++)
+        {
+            blocks.push_back(AsIRBlock(func->bb_list[i]));
+            blocks.back()->index = i;
+        }
+        succs.resize(blocks.size());
+        preds.resize(blocks.size());
+        for (size_t b = 0; b < blocks.size(); b++)
+        {
+            ForEachSuccessor(blocks[b], [&](IRBasicBlock *succ, vector<const void *> &)
+            {
+                succs[b].push_back(succ->index);
+                preds[succ->index].push_back(b);
+            });
+        }
+    }
+};
+
+// 从 root 出发可达的结点的逆后序
+inline vector<int> ReversePostorder(const vector<vector<int> > &succs, int root)
+{
+    vector<int> order;
+    vector<bool> visited(succs.size(), false);
+    vector<pair<int, size_t> > stack = {make_pair(root, 0)};
+    visited[root] = true;
+    while (!stack.empty())
+    {
+        int node = stack.back().first;
+        size_t &next = stack.back().second;
+        if (next < succs[node].size())
+        {
+            int succ = succs[node][next++];
+            if (!visited[succ])
+            {
+                visited[succ] = true;
+                stack.push_back(make_pair(succ, 0));
+            }
+            continue;
+        }
+        order.push_back(node);
+        stack.pop_back();
+    }
+    return vector<int>(order.rbegin(), order.rend());
+}
+
+// 直接支配者, root 的直接支配者是它自己, 从 root 不可达的结点为 -1
+inline vector<int> ComputeIdom(const vector<vector<int> > &succs, const vector<vector<int> > &preds, int root)
+{
+    vector<int> rpo = ReversePostorder(succs, root);
+    vector<int> rpo_index(succs.size(), -1);
+    for (size_t i = 0; i < rpo.size(); i++)
+    {
+        rpo_index[rpo[i]] = i;
+    }
+    vector<int> idom(succs.size(), -1);
+    idom[root] = root;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = 1; i < rpo.size(); i++)
+        {
+            int node = rpo[i];
+            int new_idom = -1;
+            for (int pred: preds[node])
+            {
+                if (idom[pred] < 0)
+                {
+                    continue;
+                }
+                if (new_idom < 0)
+                {
+                    new_idom = pred;
+                    continue;
+                }
+                int a = pred, b = new_idom;
+                while (a != b)
+                {
+                    while (rpo_index[a] > rpo_index[b])
+                    {
+                        a = idom[a];
+                    }
+                    while (rpo_index[b] > rpo_index[a])
+                    {
+                        b = idom[b];
+                    }
+                }
+                new_idom = a;
+            }
+            if (idom[node] != new_idom)
+            {
+                idom[node] = new_idom;
+                changed = true;
+            }
+        }
+    }
+    return idom;
+}
+
+// 支配边界: 结点 y 在 x 的支配边界中, 当且仅当 x 支配 y 的某个前驱但不严格支配 y
+inline vector<vector<int> > ComputeFrontiers(const vector<vector<int> > &preds, const vector<int> &idom)
+{
+    vector<vector<int> > frontiers(preds.size());
+    for (size_t node = 0; node < preds.size(); node++)
+    {
+        if (idom[node] < 0)
+        {
+            continue;
+        }
+        for (int pred: preds[node])
+        {
+            for (int runner = pred; idom[runner] >= 0 && runner != idom[node]; runner = idom[runner])
+            {
+                if (frontiers[runner].empty() || frontiers[runner].back() != (int)node)
+                {
+                    frontiers[runner].push_back(node);
+                }
+                if (runner == idom[runner])
+                {
+                    break;
+                }
+            }
+        }
+    }
+    return frontiers;
+}
+
+// 删除从入口不可达的基本块, 其余块保持原来的顺序
+inline bool RemoveUnreachableBlocks(IRFunction *func)
+{
+    IRCfg cfg(func);
+    vector<int> rpo = ReversePostorder(cfg.succs, 0);
+    if (rpo.size() == cfg.blocks.size())
+    {
+        return false;
+    }
+    vector<bool> reachable(cfg.blocks.size(), false);
+    for (int b: rpo)
+    {
+        reachable[b] = true;
+    }
+    vector<const void *> bb_list;
+    for (size_t b = 0; b < cfg.blocks.size(); b++)
+    {
+        if (reachable[b])
+        {
+            bb_list.push_back(cfg.blocks[b]);
+        }
+    }
+    func->bb_list.swap(bb_list);
+    return true;
+}
+
+// 以基本块在 bb_list 中的位置为下标: 跳转到这个块的每条边的实参列表
+inline vector<vector<vector<const void *> *> > IncomingArgs(IRFunction *func)
+{
+    vector<vector<vector<const void *> *> > incoming(func->bb_list.size());
+    for (size_t i = 0; i < func->bb_list.size(); i++)
+    {
+        AsIRBlock(func->bb_list[i])->index = i;
+    }
+    for (const void *ptr: func->bb_list)
+    {
+        ForEachSuccessor(AsIRBlock(ptr), [&](IRBasicBlock *succ, vector<const void *> &args)
+        {
+            incoming[succ->index].push_back(&args);
+        });
+    }
+    return incoming;
+}
+
+// 删除基本块的第 i 个参数, 以及每条入边上对应的实参
+inline void EraseBlockParam(IRBasicBlock *bb, int i, const vector<vector<const void *> *> &incoming)
+{
+    bb->param_list.erase(bb->param_list.begin() + i);
+    for (vector<const void *> *args: incoming)
+    {
+        args->erase(args->begin() + i);
+    }
+    for (size_t j = i; j < bb->param_list.size(); j++)
+    {
+        AsIRValue(bb->param_list[j])->kind.data.block_arg_ref.index = j;
+    }
+}
+
+typedef unordered_map<koopa_raw_value_t, koopa_raw_value_t> value_map_t;
+
+// 替换可以是链式的: a 替换为 b 之后 b 又被替换为 c
+inline koopa_raw_value_t ResolveValue(const value_map_t &replaced, koopa_raw_value_t value)
+{
+    for (auto it = replaced.find(value); it != replaced.end(); it = replaced.find(value))
+    {
+        value = it->second;
+    }
+    return value;
+}
+
+inline void ReplaceUses(IRFunction *func, const value_map_t &replaced)
+{
+    if (replaced.empty())
+    {
+        return;
+    }
+    for (const void *bb: func->bb_list)
+    {
+        for (const void *ptr: AsIRBlock(bb)->inst_list)
+        {
+            ForEachIROperand(AsIRValue(ptr), [&](koopa_raw_value_t &operand)
+            {
+                operand = ResolveValue(replaced, operand);
+            });
+        }
+    }
+}
+
+inline bool SameValue(koopa_raw_value_t lhs, koopa_raw_value_t rhs)
+{
+    if (lhs->kind.tag == KOOPA_RVT_INTEGER && rhs->kind.tag == KOOPA_RVT_INTEGER)
+    {
+        return lhs->kind.data.integer.value == rhs->kind.data.integer.value;
+    }
+    return lhs == rhs;
+}
+
+// 反复删除所有实参都相同 (或就是参数自己) 的块参数, 删除一个参数后其它参数可能随之变得多余.
+// 没有入边的参数替换为 0
+inline bool RemoveTrivialParams(IRBuilder &builder, IRFunction *func)
+{
+    value_map_t replaced;
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        vector<vector<vector<const void *> *> > incoming = IncomingArgs(func);
+        for (const void *ptr: func->bb_list)
+        {
+            IRBasicBlock *bb = AsIRBlock(ptr);
+            for (int i = (int)bb->param_list.size() - 1; i >= 0; i--)
+            {
+                koopa_raw_value_t param = reinterpret_cast<koopa_raw_value_t>(bb->param_list[i]);
+                koopa_raw_value_t same = nullptr;
+                bool trivial = true;
+                for (vector<const void *> *args: incoming[bb->index])
+                {
+                    koopa_raw_value_t arg = ResolveValue(replaced, reinterpret_cast<koopa_raw_value_t>((*args)[i]));
+                    if (arg == param || (same != nullptr && SameValue(arg, same)))
+                    {
+                        continue;
+                    }
+                    if (same != nullptr)
+                    {
+                        trivial = false;
+                        break;
+                    }
+                    same = arg;
+                }
+                if (trivial)
+                {
+                    replaced[param] = (same == nullptr) ? builder.Integer(0) : same;
+                    EraseBlockParam(bb, i, incoming[bb->index]);
+                    changed = true;
+                }
+            }
+        }
+    }
+    ReplaceUses(func, replaced);
+    return !replaced.empty();
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include "arena.h"
+#include "emitter.h"
+#include "frame.h"
+#include "ir.h"
+#include "koopa.h"
+#include "mir.h"
+#include "table.h"
+
+using namespace std;
+
+typedef struct
+{
+    IRBasicBlock *entry;
+    IRBasicBlock *end;
+} loop_info_t;
+
+// 一次编译 (一个输入文件) 用到的全部状态. 编译器中不再有可变的全局变量,
+// 因此不同线程上的多个 CompilationContext 可以同时编译不同的文件.
+class CompilationContext
+{
+public:
+    // 词法/语法分析
+    Arena ast_arena;
+    SymbolPool symbol_pool;
+
+    // 中间代码生成
+    IRBuilder ir_builder;
+    SymbolTableStack symbol_table_stack;
+    unordered_map<symbol_id_t, koopa_raw_function_t> func_map;
+    int label_count = 0;
+    bool is_ret = false;
+    int alloc_tmp = 0;
+    vector<loop_info_t> while_stack;
+    symbol_id_t current_func = 0;
+
+    // 目标代码生成
+    // 以全局变量的编号为下标
+    vector<var_info_t> global_vars;
+    int global_count = 0;
+    unsigned codegen_jobs = 1;
+    // -O0 / -O1 使用线性扫描寄存器分配, -O2 使用图着色寄存器分配
+    int opt_level = 1;
+
+    Emitter emitter;
+
+    CompilationContext() = default;
+    CompilationContext(const CompilationContext &) = delete;
+    CompilationContext &operator=(const CompilationContext &) = delete;
+};
+
+// 目标代码生成时单个函数的状态. 全局变量布局完成后各函数互不依赖,
+// 每个函数生成到自己的 emitter 缓冲区中, 因此可以在不同线程上同时生成.
+class FunctionContext
+{
+public:
+    MachineFunction mf;
+    int cur_block = 0;
+    // 以下数组都以值在函数中的编号为下标: 值在目标代码中的位置, 以及位置是否已经确定
+    vector<var_info_t> values;
+    vector<bool> is_visited;
+    // 只被所在块末尾的 branch 使用的比较运算, 与 branch 合并为一条条件跳转
+    vector<bool> branch_conds;
+    // 作为尾调用生成的 call 以及紧随其后的 ret
+    vector<bool> tail_calls;
+    // 以全局变量的编号为下标: 最近一次用 lui 取得它的高位地址的基本块和虚拟寄存器, 生成 call 后清空
+    vector<pair<int, int> > global_bases;
+    Emitter emitter;
+
+    void Init(int value_num, int global_num)
+    {
+        values.resize(value_num);
+        is_visited.assign(value_num, false);
+        branch_conds.assign(value_num, false);
+        tail_calls.assign(value_num, false);
+        global_bases.assign(global_num, make_pair(-1, NO_REG));
+    }
+};
+
+// 当前线程正在进行的编译, 以及正在生成目标代码的函数
+inline thread_local CompilationContext *ctx = nullptr;
+inline thread_local FunctionContext *fctx = nullptr;
+
+inline void initSysyRuntimeLib()
+{
+    IRBuilder &ir_builder = ctx->ir_builder;
+    SymbolPool &symbol_pool = ctx->symbol_pool;
+    koopa_raw_type_t i32 = ir_builder.I32();
+    koopa_raw_type_t ptr = ir_builder.PtrI32();
+    koopa_raw_type_t unit = ir_builder.Unit();
+    ctx->func_map[symbol_pool.Intern("getint")] = ir_builder.DeclareFunction("@getint", {}, i32);
+    ctx->func_map[symbol_pool.Intern("getch")] = ir_builder.DeclareFunction("@getch", {}, i32);
+    ctx->func_map[symbol_pool.Intern("getarray")] = ir_builder.DeclareFunction("@getarray", {ptr}, i32);
+    ctx->func_map[symbol_pool.Intern("putint")] = ir_builder.DeclareFunction("@putint", {i32}, unit);
+    ctx->func_map[symbol_pool.Intern("putch")] = ir_builder.DeclareFunction("@putch", {i32}, unit);
+    ctx->func_map[symbol_pool.Intern("putarray")] = ir_builder.DeclareFunction("@putarray", {i32, ptr}, unit);
+    ctx->func_map[symbol_pool.Intern("starttime")] = ir_builder.DeclareFunction("@starttime", {}, unit);
+    ctx->func_map[symbol_pool.Intern("stoptime")] = ir_builder.DeclareFunction("@stoptime", {}, unit);
+}
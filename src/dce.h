@@ -0,0 +1,364 @@
+#pragma once
+#include <unordered_set>
+#include <vector>
+#include "cfg.h"
+#include "ir.h"
+#include "koopa.h"
+
+using namespace std;
+
+// 死存储消除: 从未被 load 过的 alloc 上的 store 都是死的; 在同一个基本块中, store 之后在读取这个地址
+// (load 或 call) 之前又被 store 覆盖, 或者之后到 ret 为止都没有再读取的局部变量, 这个 store 也是死的.
+// mem2reg 之后只剩下地址逃逸的 alloc, 块内的规则对全局变量同样适用.
+inline bool EliminateDeadStores(IRFunction *func)
+{
+    unordered_set<koopa_raw_value_t> loaded, escaped;
+    for (const void *bb: func->bb_list)
+    {
+        for (const void *ptr: AsIRBlock(bb)->inst_list)
+        {
+            IRValue *inst = AsIRValue(ptr);
+            if (inst->kind.tag == KOOPA_RVT_LOAD)
+            {
+                loaded.insert(inst->kind.data.load.src);
+                continue;
+            }
+            ForEachIROperand(inst, [&](koopa_raw_value_t &operand)
+            {
+                bool is_dest = inst->kind.tag == KOOPA_RVT_STORE && &operand == &inst->kind.data.store.dest;
+                if (operand->kind.tag == KOOPA_RVT_ALLOC && !is_dest)
+                {
+                    escaped.insert(operand);
+                }
+            });
+        }
+    }
+    bool changed = false;
+    for (const void *bb: func->bb_list)
+    {
+        vector<const void *> &inst_list = AsIRBlock(bb)->inst_list;
+        // 从块末尾向前扫描: 之后会被覆盖而中间没有读取的地址, 之后是否会执行到 ret (中间没有 call),
+        // 以及之后到 ret 为止读取过的地址
+        unordered_set<koopa_raw_value_t> overwritten, read_before_ret;
+        bool before_ret = false;
+        vector<const void *> insts;
+        for (auto it = inst_list.rbegin(); it != inst_list.rend(); ++it)
+        {
+            const IRValue *inst = AsIRValue(*it);
+            const auto &kind = inst->kind;
+            if (kind.tag == KOOPA_RVT_RETURN)
+            {
+                before_ret = true;
+            }
+            else if (kind.tag == KOOPA_RVT_LOAD)
+            {
+                overwritten.erase(kind.data.load.src);
+                read_before_ret.insert(kind.data.load.src);
+            }
+            else if (kind.tag == KOOPA_RVT_CALL)
+            {
+                overwritten.clear();
+                before_ret = false;
+            }
+            else if (kind.tag == KOOPA_RVT_STORE)
+            {
+                koopa_raw_value_t dest = kind.data.store.dest;
+                bool is_local = dest->kind.tag == KOOPA_RVT_ALLOC && escaped.count(dest) == 0;
+                bool dead_at_ret = before_ret && read_before_ret.count(dest) == 0;
+                if ((is_local && (dead_at_ret || loaded.count(dest) == 0)) || overwritten.count(dest) != 0)
+                {
+                    changed = true;
+                    continue;
+                }
+                overwritten.insert(dest);
+            }
+            insts.push_back(inst);
+        }
+        inst_list.assign(insts.rbegin(), insts.rend());
+    }
+    return changed;
+}
+
+// 基于控制依赖的激进死代码删除 (Cytron 等人). 先假定所有指令都是死的, 从有副作用的指令 (store, call, ret) 出发,
+// 活的指令使它的操作数, 所在块控制依赖的 br 以及 (对块参数而言) 各条入边上的跳转和实参都变成活的.
+// 控制依赖由后支配树上的支配边界得到. 最后删除死的指令和块参数, 死的 br 改为跳到最近的活的后支配块.
+// 循环回边所在的跳转, 以及到不了 ret 的块的跳转始终是活的, 不会把不终止的循环删掉.
+class AggressiveDCE
+{
+private:
+    IRFunction *func;
+    IRCfg cfg;
+    // 运行期间块参数和指令的 index 暂时记录它们在 values 中的位置
+    vector<IRValue *> values;
+    vector<int> value_block;
+    vector<bool> live;
+    vector<bool> live_block;
+    vector<int> ipdom;
+    vector<vector<int> > control_deps;
+    vector<vector<vector<const void *> *> > incoming;
+    vector<int> worklist;
+    int exit_node;
+
+    int LocalIndex(koopa_raw_value_t value) const
+    {
+        switch (value->kind.tag)
+        {
+        case KOOPA_RVT_INTEGER:
+        case KOOPA_RVT_ZERO_INIT:
+        case KOOPA_RVT_GLOBAL_ALLOC:
+        case KOOPA_RVT_FUNC_ARG_REF:
+            return -1;
+        default:
+            return ValueIndex(value);
+        }
+    }
+    IRValue *Terminator(int block) const
+    {
+        return AsIRValue(cfg.blocks[block]->inst_list.back());
+    }
+    void MarkLive(koopa_raw_value_t value)
+    {
+        int index = LocalIndex(value);
+        if (index >= 0 && !live[index])
+        {
+            live[index] = true;
+            worklist.push_back(index);
+        }
+    }
+    void NumberValues()
+    {
+        for (size_t b = 0; b < cfg.blocks.size(); b++)
+        {
+            for (const void *param: cfg.blocks[b]->param_list)
+            {
+                AsIRValue(param)->index = values.size();
+                values.push_back(AsIRValue(param));
+                value_block.push_back(b);
+            }
+            for (const void *inst: cfg.blocks[b]->inst_list)
+            {
+                AsIRValue(inst)->index = values.size();
+                values.push_back(AsIRValue(inst));
+                value_block.push_back(b);
+            }
+        }
+        live.assign(values.size(), false);
+        live_block.assign(cfg.blocks.size(), false);
+        incoming = IncomingArgs(func);
+    }
+    // 在反向的控制流图上求后支配树, 虚拟的出口结点连向所有以 ret 结尾的块.
+    // 块 y 控制依赖于 x 当且仅当 x 在 y 的后支配边界中
+    void ComputeControlDeps()
+    {
+        exit_node = cfg.blocks.size();
+        vector<vector<int> > succs(exit_node + 1), preds(exit_node + 1);
+        for (int b = 0; b < exit_node; b++)
+        {
+            succs[b] = cfg.preds[b];
+            preds[b] = cfg.succs[b];
+            if (Terminator(b)->kind.tag == KOOPA_RVT_RETURN)
+            {
+                succs[exit_node].push_back(b);
+                preds[b].push_back(exit_node);
+            }
+        }
+        ipdom = ComputeIdom(succs, preds, exit_node);
+        control_deps = ComputeFrontiers(preds, ipdom);
+    }
+    // 深度优先遍历中指向栈上的块的边是回边
+    void MarkLoopBranches()
+    {
+        size_t block_num = cfg.blocks.size();
+        vector<bool> visited(block_num, false), on_stack(block_num, false);
+        vector<pair<int, size_t> > stack = {make_pair(0, 0)};
+        visited[0] = on_stack[0] = true;
+        while (!stack.empty())
+        {
+            int block = stack.back().first;
+            size_t &next = stack.back().second;
+            if (next == cfg.succs[block].size())
+            {
+                on_stack[block] = false;
+                stack.pop_back();
+                continue;
+            }
+            int succ = cfg.succs[block][next++];
+            if (on_stack[succ])
+            {
+                MarkLive(Terminator(block));
+            }
+            else if (!visited[succ])
+            {
+                visited[succ] = on_stack[succ] = true;
+                stack.push_back(make_pair(succ, 0));
+            }
+        }
+        for (size_t b = 0; b < block_num; b++)
+        {
+            if (ipdom[b] < 0)
+            {
+                MarkLive(Terminator(b));
+            }
+        }
+    }
+    void Propagate()
+    {
+        while (!worklist.empty())
+        {
+            int index = worklist.back();
+            worklist.pop_back();
+            IRValue *value = values[index];
+            int block = value_block[index];
+            if (!live_block[block])
+            {
+                live_block[block] = true;
+                for (int dep: control_deps[block])
+                {
+                    MarkLive(Terminator(dep));
+                }
+            }
+            switch (value->kind.tag)
+            {
+            case KOOPA_RVT_BLOCK_ARG_REF:
+                for (int pred: cfg.preds[block])
+                {
+                    MarkLive(Terminator(pred));
+                }
+                for (vector<const void *> *args: incoming[block])
+                {
+                    MarkLive(reinterpret_cast<koopa_raw_value_t>((*args)[value->kind.data.block_arg_ref.index]));
+                }
+                break;
+            case KOOPA_RVT_BRANCH:
+                MarkLive(value->kind.data.branch.cond);
+                break;
+            case KOOPA_RVT_JUMP:
+                break;
+            default:
+                ForEachIROperand(value, [&](koopa_raw_value_t &operand)
+                {
+                    MarkLive(operand);
+                });
+                break;
+            }
+        }
+    }
+    // 死的 br 跳到最近的活的后支配块. 这个块的参数必须都是死的, 否则 (或者一直到出口都没有活的块) 把 br 标记为活的
+    int NewTarget(int block) const
+    {
+        int target = ipdom[block];
+        while (target != exit_node && !live_block[target])
+        {
+            target = ipdom[target];
+        }
+        if (target == exit_node)
+        {
+            return -1;
+        }
+        for (const void *param: cfg.blocks[target]->param_list)
+        {
+            if (live[ValueIndex(reinterpret_cast<koopa_raw_value_t>(param))])
+            {
+                return -1;
+            }
+        }
+        return target;
+    }
+    void MarkFallbackBranches()
+    {
+        bool changed = true;
+        while (changed)
+        {
+            Propagate();
+            changed = false;
+            for (size_t b = 0; b < cfg.blocks.size(); b++)
+            {
+                IRValue *last = Terminator(b);
+                if (last->kind.tag == KOOPA_RVT_BRANCH && !live[last->index] && NewTarget(b) < 0)
+                {
+                    MarkLive(last);
+                    changed = true;
+                }
+            }
+        }
+    }
+    bool Rewrite()
+    {
+        bool changed = false;
+        for (size_t b = 0; b < cfg.blocks.size(); b++)
+        {
+            IRBasicBlock *bb = cfg.blocks[b];
+            for (int i = (int)bb->param_list.size() - 1; i >= 0; i--)
+            {
+                if (!live[AsIRValue(bb->param_list[i])->index])
+                {
+                    EraseBlockParam(bb, i, incoming[b]);
+                    changed = true;
+                }
+            }
+        }
+        for (size_t b = 0; b < cfg.blocks.size(); b++)
+        {
+            IRBasicBlock *bb = cfg.blocks[b];
+            IRValue *last = Terminator(b);
+            if (last->kind.tag == KOOPA_RVT_BRANCH && !live[last->index])
+            {
+                last->arg_list.clear();
+                last->false_arg_list.clear();
+                last->kind.tag = KOOPA_RVT_JUMP;
+                last->kind.data.jump.target = cfg.blocks[NewTarget(b)];
+                changed = true;
+            }
+            vector<const void *> insts;
+            for (const void *ptr: bb->inst_list)
+            {
+                if (live[AsIRValue(ptr)->index] || ptr == last)
+                {
+                    insts.push_back(ptr);
+                }
+            }
+            changed |= (insts.size() != bb->inst_list.size());
+            bb->inst_list.swap(insts);
+        }
+        return RemoveUnreachableBlocks(func) || changed;
+    }
+public:
+    AggressiveDCE(IRFunction *func) : func(func), cfg(func)
+    {
+    }
+    bool Run()
+    {
+        NumberValues();
+        ComputeControlDeps();
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            switch (values[i]->kind.tag)
+            {
+            case KOOPA_RVT_STORE:
+            case KOOPA_RVT_CALL:
+            case KOOPA_RVT_RETURN:
+                MarkLive(values[i]);
+                break;
+            default:
+                break;
+            }
+        }
+        MarkLoopBranches();
+        MarkFallbackBranches();
+        return Rewrite();
+    }
+};
+
+// 删掉死的 load 之后, 它前面的 store 可能也变成死的, 反复进行直到不再变化
+inline bool EliminateDeadCode(IRFunction *func)
+{
+    bool changed = false;
+    bool removed = true;
+    while (removed)
+    {
+        changed |= EliminateDeadStores(func);
+        removed = AggressiveDCE(func).Run();
+        changed |= removed;
+    }
+    return changed;
+}
@@ -0,0 +1,123 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#define EMIT_BUFFER_SIZE (1 << 16)
+
+using namespace std;
+
+// 所有 Koopa IR / RISC-V 输出都经过 Emitter: 内容先写入缓冲区, 缓冲区满或 Close() 时才写文件.
+// 换行不会刷新缓冲区, 整数直接格式化到缓冲区里, 不经过临时的 string.
+// 没有 Open() 文件的 Emitter 把内容累积在内存中, 由 TakeText() 取出.
+class Emitter
+{
+private:
+    FILE *file = nullptr;
+    string text;
+    size_t len = 0;
+    char buffer[EMIT_BUFFER_SIZE];
+
+    void Write(const char *str, size_t n)
+    {
+        if (len + n > EMIT_BUFFER_SIZE)
+        {
+            Flush();
+            if (n > EMIT_BUFFER_SIZE)
+            {
+                if (file != nullptr)
+                {
+                    fwrite(str, 1, n, file);
+                }
+                else
+                {
+                    text.append(str, n);
+                }
+                return;
+            }
+        }
+        memcpy(buffer + len, str, n);
+        len += n;
+    }
+public:
+    bool Open(const char *path)
+    {
+        file = fopen(path, "w");
+        len = 0;
+        return file != nullptr;
+    }
+    void Flush()
+    {
+        if (file != nullptr)
+        {
+            fwrite(buffer, 1, len, file);
+        }
+        else
+        {
+            text.append(buffer, len);
+        }
+        len = 0;
+    }
+    void Close()
+    {
+        assert(file != nullptr);
+        Flush();
+        fclose(file);
+        file = nullptr;
+    }
+    string TakeText()
+    {
+        assert(file == nullptr);
+        Flush();
+        return move(text);
+    }
+    Emitter &operator<<(const char *str)
+    {
+        Write(str, strlen(str));
+        return *this;
+    }
+    Emitter &operator<<(const string &str)
+    {
+        Write(str.data(), str.size());
+        return *this;
+    }
+    Emitter &operator<<(char c)
+    {
+        if (len == EMIT_BUFFER_SIZE)
+        {
+            Flush();
+        }
+        buffer[len++] = c;
+        return *this;
+    }
+    Emitter &operator<<(uint32_t value)
+    {
+        char digits[10];
+        int n = 0;
+        do
+        {
+            digits[n++] = '0' + value % 10;
+            value /= 10;
+        } while (value != 0);
+        if (len + n > EMIT_BUFFER_SIZE)
+        {
+            Flush();
+        }
+        while (n > 0)
+        {
+            buffer[len++] = digits[--n];
+        }
+        return *this;
+    }
+    Emitter &operator<<(int32_t value)
+    {
+        if (value < 0)
+        {
+            *this << '-';
+            return *this << (uint32_t)(-(int64_t)value);
+        }
+        return *this << (uint32_t)value;
+    }
+};
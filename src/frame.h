@@ -0,0 +1,79 @@
+#pragma once
+#include <cassert>
+#include <vector>
+
+using namespace std;
+
+// 栈帧中的对象: 局部变量 (alloc), 溢出的虚拟寄存器, 通过栈传入的第 9 个及以后的参数,
+// 以及已经换成虚拟寄存器, 不再占用栈空间的局部变量
+enum FrameObjectType{FO_LOCAL, FO_SPILL, FO_INCOMING, FO_DEAD};
+
+typedef struct
+{
+    FrameObjectType type;
+    int offset;
+} frame_object_t;
+
+// 栈帧从低地址到高地址依次为: 传给被调用函数的栈参数, 局部变量和溢出槽, 被保存的 callee-saved 寄存器, ra.
+// 传入参数位于调用者的栈帧中, 偏移量是 stack_size + 4 * 参数序号.
+class StackFrame
+{
+public:
+    vector<frame_object_t> objects;
+    vector<int> saved_regs;
+    int outgoing_size = 0;
+    bool store_ra = false;
+    int stack_size = 0;
+
+    int CreateObject(FrameObjectType type, int index = 0)
+    {
+        objects.push_back({type, index * 4});
+        return objects.size() - 1;
+    }
+    void Layout()
+    {
+        int top = outgoing_size;
+        for (frame_object_t &object: objects)
+        {
+            if (object.type == FrameObjectType::FO_LOCAL || object.type == FrameObjectType::FO_SPILL)
+            {
+                object.offset = top;
+                top += 4;
+            }
+        }
+        top += 4 * saved_regs.size();
+        if (store_ra)
+        {
+            top += 4;
+        }
+        stack_size = (top + 15) & (~15);
+    }
+    int ObjectOffset(int frame_index) const
+    {
+        const frame_object_t &object = objects[frame_index];
+        if (object.type == FrameObjectType::FO_INCOMING)
+        {
+            return stack_size + object.offset;
+        }
+        return object.offset;
+    }
+    int SavedRegOffset(int i) const
+    {
+        return stack_size - 4 * (int)(i + 1 + (store_ra ? 1 : 0));
+    }
+    int RaOffset() const
+    {
+        assert(store_ra);
+        return stack_size - 4;
+    }
+};
+
+enum VAR_TYPE{ON_STACK, ON_REG, ON_GLOBAL};
+
+// Koopa 值在目标代码中的位置: 虚拟寄存器, 栈帧对象 (alloc) 或全局变量
+typedef struct{
+    VAR_TYPE type;
+    int frame_index;
+    int reg_id;
+    int global_id;
+} var_info_t;
@@ -0,0 +1,660 @@
+#pragma once
+#include <cassert>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "emitter.h"
+#include "koopa.h"
+
+using namespace std;
+
+// 内存形式的 Koopa IR 直接由 AST 构建, 不再经过文本形式的 IR 和 koopa_parse_from_string.
+// 每个 IR 对象都继承自对应的 koopa_raw 结构体, 额外的 vector 用来在构建期间保存 slice 的内容,
+// Finish() 之后 slice 直接指向这些 vector 的存储. used_by 不做维护.
+// Finish() 还给每个函数中的值和基本块分配从 0 开始的连续编号, 后端用以编号为下标的数组保存它们的信息.
+
+struct IRValue : public koopa_raw_value_data
+{
+    // 参数, 基本块参数和指令在所在函数中的编号, 全局变量按定义顺序编号, 整数常量为 -1
+    int index = -1;
+    string name_buf;
+    vector<const void *> arg_list;
+    vector<const void *> false_arg_list;
+};
+
+struct IRBasicBlock : public koopa_raw_basic_block_data_t
+{
+    // 在所在函数中的顺序
+    int index = -1;
+    string name_buf;
+    vector<const void *> param_list;
+    vector<const void *> inst_list;
+};
+
+struct IRFunction : public koopa_raw_function_data_t
+{
+    string name_buf;
+    koopa_raw_type_kind_t type_kind;
+    vector<const void *> param_type_list;
+    vector<const void *> param_list;
+    vector<const void *> bb_list;
+    // 函数中已编号的值的个数
+    int value_num = 0;
+};
+
+inline IRValue *AsIRValue(const void *ptr)
+{
+    return const_cast<IRValue *>(reinterpret_cast<const IRValue *>(ptr));
+}
+
+inline IRBasicBlock *AsIRBlock(const void *ptr)
+{
+    return const_cast<IRBasicBlock *>(reinterpret_cast<const IRBasicBlock *>(ptr));
+}
+
+inline int ValueIndex(koopa_raw_value_t value)
+{
+    return static_cast<const IRValue *>(value)->index;
+}
+
+inline int BlockIndex(koopa_raw_basic_block_t bb)
+{
+    return static_cast<const IRBasicBlock *>(bb)->index;
+}
+
+inline int ValueNum(koopa_raw_function_t func)
+{
+    return static_cast<const IRFunction *>(func)->value_num;
+}
+
+// 对指令的每个值操作数 (包括跳转的实参) 调用 f, f 拿到的是操作数的引用, 可以直接替换
+template <typename F>
+void ForEachIROperand(IRValue *inst, F f)
+{
+    auto &kind = inst->kind;
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_LOAD:
+        f(kind.data.load.src);
+        break;
+    case KOOPA_RVT_STORE:
+        f(kind.data.store.value);
+        f(kind.data.store.dest);
+        break;
+    case KOOPA_RVT_BINARY:
+        f(kind.data.binary.lhs);
+        f(kind.data.binary.rhs);
+        break;
+    case KOOPA_RVT_BRANCH:
+        f(kind.data.branch.cond);
+        break;
+    case KOOPA_RVT_RETURN:
+        if (kind.data.ret.value != nullptr)
+        {
+            f(kind.data.ret.value);
+        }
+        break;
+    default:
+        break;
+    }
+    for (const void *&arg: inst->arg_list)
+    {
+        koopa_raw_value_t value = reinterpret_cast<koopa_raw_value_t>(arg);
+        f(value);
+        arg = value;
+    }
+    for (const void *&arg: inst->false_arg_list)
+    {
+        koopa_raw_value_t value = reinterpret_cast<koopa_raw_value_t>(arg);
+        f(value);
+        arg = value;
+    }
+}
+
+// 对基本块末尾的 br / jump 的每条出边调用 f(目标块, 这条边的实参)
+template <typename F>
+void ForEachSuccessor(IRBasicBlock *bb, F f)
+{
+    IRValue *last = AsIRValue(bb->inst_list.back());
+    if (last->kind.tag == KOOPA_RVT_BRANCH)
+    {
+        f(AsIRBlock(last->kind.data.branch.true_bb), last->arg_list);
+        f(AsIRBlock(last->kind.data.branch.false_bb), last->false_arg_list);
+    }
+    else if (last->kind.tag == KOOPA_RVT_JUMP)
+    {
+        f(AsIRBlock(last->kind.data.jump.target), last->arg_list);
+    }
+}
+
+inline koopa_raw_slice_t EmptySlice(koopa_raw_slice_item_kind_t kind)
+{
+    koopa_raw_slice_t slice;
+    slice.buffer = nullptr;
+    slice.len = 0;
+    slice.kind = kind;
+    return slice;
+}
+
+inline koopa_raw_slice_t MakeSlice(vector<const void *> &vec, koopa_raw_slice_item_kind_t kind)
+{
+    koopa_raw_slice_t slice;
+    slice.buffer = vec.empty() ? nullptr : vec.data();
+    slice.len = vec.size();
+    slice.kind = kind;
+    return slice;
+}
+
+class IRBuilder
+{
+private:
+    koopa_raw_type_kind_t i32_type;
+    koopa_raw_type_kind_t unit_type;
+    koopa_raw_type_kind_t ptr_type;
+    vector<unique_ptr<IRValue> > values;
+    vector<unique_ptr<IRBasicBlock> > blocks;
+    vector<unique_ptr<IRFunction> > funcs;
+    vector<const void *> global_list;
+    vector<const void *> func_list;
+    IRFunction *cur_func = nullptr;
+    IRBasicBlock *cur_bb = nullptr;
+
+    IRValue *NewValue(koopa_raw_type_t ty, koopa_raw_value_tag_t tag, const string &name = "")
+    {
+        IRValue *value = new IRValue();
+        values.emplace_back(value);
+        value->name_buf = name;
+        value->ty = ty;
+        value->name = name.empty() ? nullptr : value->name_buf.c_str();
+        value->used_by = EmptySlice(KOOPA_RSIK_VALUE);
+        value->kind.tag = tag;
+        return value;
+    }
+    koopa_raw_value_t Insert(IRValue *inst)
+    {
+        assert(cur_bb != nullptr);
+        cur_bb->inst_list.push_back(inst);
+        return inst;
+    }
+public:
+    IRBuilder()
+    {
+        i32_type.tag = KOOPA_RTT_INT32;
+        unit_type.tag = KOOPA_RTT_UNIT;
+        ptr_type.tag = KOOPA_RTT_POINTER;
+        ptr_type.data.pointer.base = &i32_type;
+    }
+    koopa_raw_type_t I32() const
+    {
+        return &i32_type;
+    }
+    koopa_raw_type_t Unit() const
+    {
+        return &unit_type;
+    }
+    koopa_raw_type_t PtrI32() const
+    {
+        return &ptr_type;
+    }
+
+    IRFunction *DeclareFunction(const string &name, const vector<koopa_raw_type_t> &param_types, koopa_raw_type_t ret_type)
+    {
+        IRFunction *func = new IRFunction();
+        funcs.emplace_back(func);
+        func->name_buf = name;
+        func->name = func->name_buf.c_str();
+        for (auto ty: param_types)
+        {
+            func->param_type_list.push_back(ty);
+        }
+        func->type_kind.tag = KOOPA_RTT_FUNCTION;
+        func->type_kind.data.function.ret = ret_type;
+        func->ty = &func->type_kind;
+        func_list.push_back(func);
+        return func;
+    }
+    IRFunction *DefineFunction(const string &name, const vector<string> &param_names, koopa_raw_type_t ret_type)
+    {
+        vector<koopa_raw_type_t> param_types(param_names.size(), I32());
+        IRFunction *func = DeclareFunction(name, param_types, ret_type);
+        for (size_t i = 0; i < param_names.size(); i++)
+        {
+            IRValue *param = NewValue(I32(), KOOPA_RVT_FUNC_ARG_REF, param_names[i]);
+            param->kind.data.func_arg_ref.index = i;
+            func->param_list.push_back(param);
+        }
+        cur_func = func;
+        cur_bb = nullptr;
+        return func;
+    }
+    IRBasicBlock *NewBlock(const string &name)
+    {
+        IRBasicBlock *bb = new IRBasicBlock();
+        blocks.emplace_back(bb);
+        bb->name_buf = name;
+        bb->name = bb->name_buf.c_str();
+        return bb;
+    }
+    // 对应文本形式中打印标签: 基本块在第一次成为插入点时追加到当前函数
+    void SetInsertBlock(IRBasicBlock *bb)
+    {
+        assert(cur_func != nullptr);
+        cur_func->bb_list.push_back(bb);
+        cur_bb = bb;
+    }
+    // IR 上的优化在 Finish() 之前直接修改函数和基本块中的 vector, 新指令追加到 SetInsertPoint 指定的块末尾
+    const vector<unique_ptr<IRFunction> > &Functions() const
+    {
+        return funcs;
+    }
+    void SetInsertPoint(IRBasicBlock *bb)
+    {
+        cur_bb = bb;
+    }
+
+    // 基本块参数追加在参数列表末尾
+    koopa_raw_value_t BlockParam(IRBasicBlock *bb)
+    {
+        IRValue *param = NewValue(I32(), KOOPA_RVT_BLOCK_ARG_REF);
+        param->kind.data.block_arg_ref.index = bb->param_list.size();
+        bb->param_list.push_back(param);
+        return param;
+    }
+    koopa_raw_value_t Integer(int32_t value)
+    {
+        IRValue *integer = NewValue(I32(), KOOPA_RVT_INTEGER);
+        integer->kind.data.integer.value = value;
+        return integer;
+    }
+    koopa_raw_value_t ZeroInit()
+    {
+        return NewValue(I32(), KOOPA_RVT_ZERO_INIT);
+    }
+    koopa_raw_value_t GlobalAlloc(const string &name, koopa_raw_value_t init)
+    {
+        IRValue *alloc = NewValue(PtrI32(), KOOPA_RVT_GLOBAL_ALLOC, name);
+        alloc->kind.data.global_alloc.init = init;
+        global_list.push_back(alloc);
+        return alloc;
+    }
+    koopa_raw_value_t Alloc(const string &name)
+    {
+        return Insert(NewValue(PtrI32(), KOOPA_RVT_ALLOC, name));
+    }
+    koopa_raw_value_t Load(koopa_raw_value_t src)
+    {
+        IRValue *load = NewValue(I32(), KOOPA_RVT_LOAD);
+        load->kind.data.load.src = src;
+        return Insert(load);
+    }
+    koopa_raw_value_t Store(koopa_raw_value_t value, koopa_raw_value_t dest)
+    {
+        IRValue *store = NewValue(Unit(), KOOPA_RVT_STORE);
+        store->kind.data.store.value = value;
+        store->kind.data.store.dest = dest;
+        return Insert(store);
+    }
+    koopa_raw_value_t Binary(koopa_raw_binary_op_t op, koopa_raw_value_t lhs, koopa_raw_value_t rhs)
+    {
+        IRValue *binary = NewValue(I32(), KOOPA_RVT_BINARY);
+        binary->kind.data.binary.op = op;
+        binary->kind.data.binary.lhs = lhs;
+        binary->kind.data.binary.rhs = rhs;
+        return Insert(binary);
+    }
+    koopa_raw_value_t Branch(koopa_raw_value_t cond, IRBasicBlock *true_bb, IRBasicBlock *false_bb)
+    {
+        IRValue *branch = NewValue(Unit(), KOOPA_RVT_BRANCH);
+        branch->kind.data.branch.cond = cond;
+        branch->kind.data.branch.true_bb = true_bb;
+        branch->kind.data.branch.false_bb = false_bb;
+        return Insert(branch);
+    }
+    koopa_raw_value_t Jump(IRBasicBlock *target)
+    {
+        IRValue *jump = NewValue(Unit(), KOOPA_RVT_JUMP);
+        jump->kind.data.jump.target = target;
+        return Insert(jump);
+    }
+    koopa_raw_value_t Call(koopa_raw_function_t callee, const vector<koopa_raw_value_t> &args)
+    {
+        IRValue *call = NewValue(callee->ty->data.function.ret, KOOPA_RVT_CALL);
+        call->kind.data.call.callee = callee;
+        for (auto arg: args)
+        {
+            call->arg_list.push_back(arg);
+        }
+        return Insert(call);
+    }
+    koopa_raw_value_t Return(koopa_raw_value_t value)
+    {
+        IRValue *ret = NewValue(Unit(), KOOPA_RVT_RETURN);
+        ret->kind.data.ret.value = value;
+        return Insert(ret);
+    }
+
+    // 把构建期间的 vector 写回各个 slice, 返回可以直接交给后端的 raw program
+    koopa_raw_program_t Finish()
+    {
+        for (size_t i = 0; i < global_list.size(); i++)
+        {
+            AsIRValue(global_list[i])->index = i;
+        }
+        for (auto &func: funcs)
+        {
+            int value_num = 0;
+            for (const void *param: func->param_list)
+            {
+                AsIRValue(param)->index = value_num++;
+            }
+            for (size_t i = 0; i < func->bb_list.size(); i++)
+            {
+                IRBasicBlock *bb = AsIRBlock(func->bb_list[i]);
+                bb->index = i;
+                for (const void *param: bb->param_list)
+                {
+                    AsIRValue(param)->index = value_num++;
+                }
+                for (const void *inst: bb->inst_list)
+                {
+                    AsIRValue(inst)->index = value_num++;
+                }
+            }
+            func->value_num = value_num;
+            func->type_kind.data.function.params = MakeSlice(func->param_type_list, KOOPA_RSIK_TYPE);
+            func->params = MakeSlice(func->param_list, KOOPA_RSIK_VALUE);
+            func->bbs = MakeSlice(func->bb_list, KOOPA_RSIK_BASIC_BLOCK);
+        }
+        for (auto &bb: blocks)
+        {
+            bb->params = MakeSlice(bb->param_list, KOOPA_RSIK_VALUE);
+            bb->used_by = EmptySlice(KOOPA_RSIK_VALUE);
+            bb->insts = MakeSlice(bb->inst_list, KOOPA_RSIK_VALUE);
+        }
+        for (auto &value: values)
+        {
+            if (value->kind.tag == KOOPA_RVT_CALL)
+            {
+                value->kind.data.call.args = MakeSlice(value->arg_list, KOOPA_RSIK_VALUE);
+            }
+            else if (value->kind.tag == KOOPA_RVT_BRANCH)
+            {
+                value->kind.data.branch.true_args = MakeSlice(value->arg_list, KOOPA_RSIK_VALUE);
+                value->kind.data.branch.false_args = MakeSlice(value->false_arg_list, KOOPA_RSIK_VALUE);
+            }
+            else if (value->kind.tag == KOOPA_RVT_JUMP)
+            {
+                value->kind.data.jump.args = MakeSlice(value->arg_list, KOOPA_RSIK_VALUE);
+            }
+        }
+        koopa_raw_program_t program;
+        program.values = MakeSlice(global_list, KOOPA_RSIK_VALUE);
+        program.funcs = MakeSlice(func_list, KOOPA_RSIK_FUNCTION);
+        return program;
+    }
+};
+
+// 文本形式的 Koopa IR 只在 -koopa 模式下由内存形式打印得到
+
+class KoopaPrinter
+{
+private:
+    Emitter &emitter;
+    unordered_map<koopa_raw_value_t, int> value_ids;
+    int value_count = 0;
+
+    void DumpType(koopa_raw_type_t ty)
+    {
+        switch (ty->tag)
+        {
+        case KOOPA_RTT_INT32:
+            emitter << "i32";
+            break;
+        case KOOPA_RTT_POINTER:
+            emitter << "*";
+            DumpType(ty->data.pointer.base);
+            break;
+        default:
+            assert(false);
+        }
+    }
+    void DumpOperand(koopa_raw_value_t value)
+    {
+        if (value->kind.tag == KOOPA_RVT_INTEGER)
+        {
+            emitter << value->kind.data.integer.value;
+        }
+        else if (value->name != nullptr)
+        {
+            emitter << value->name;
+        }
+        else
+        {
+            assert(value_ids.find(value) != value_ids.end());
+            emitter << "%" << value_ids[value];
+        }
+    }
+    void DumpArgs(const koopa_raw_slice_t &args)
+    {
+        for (uint32_t i = 0; i < args.len; i++)
+        {
+            if (i != 0)
+            {
+                emitter << ", ";
+            }
+            DumpOperand(reinterpret_cast<koopa_raw_value_t>(args.buffer[i]));
+        }
+    }
+    void DumpTarget(koopa_raw_basic_block_t bb, const koopa_raw_slice_t &args)
+    {
+        emitter << bb->name;
+        if (args.len != 0)
+        {
+            emitter << "(";
+            DumpArgs(args);
+            emitter << ")";
+        }
+    }
+    void DumpInst(koopa_raw_value_t inst)
+    {
+        static const char *binary_names[] = {"ne", "eq", "gt", "lt", "ge", "le", "add", "sub", "mul", "div", "mod", "and", "or", "xor", "shl", "shr", "sar"};
+        const auto &kind = inst->kind;
+        emitter << "  ";
+        if (inst->ty->tag != KOOPA_RTT_UNIT)
+        {
+            DumpOperand(inst);
+            emitter << " = ";
+        }
+        switch (kind.tag)
+        {
+        case KOOPA_RVT_ALLOC:
+            emitter << "alloc ";
+            DumpType(inst->ty->data.pointer.base);
+            break;
+        case KOOPA_RVT_LOAD:
+            emitter << "load ";
+            DumpOperand(kind.data.load.src);
+            break;
+        case KOOPA_RVT_STORE:
+            emitter << "store ";
+            DumpOperand(kind.data.store.value);
+            emitter << ", ";
+            DumpOperand(kind.data.store.dest);
+            break;
+        case KOOPA_RVT_BINARY:
+            emitter << binary_names[kind.data.binary.op] << " ";
+            DumpOperand(kind.data.binary.lhs);
+            emitter << ", ";
+            DumpOperand(kind.data.binary.rhs);
+            break;
+        case KOOPA_RVT_BRANCH:
+            emitter << "br ";
+            DumpOperand(kind.data.branch.cond);
+            emitter << ", ";
+            DumpTarget(kind.data.branch.true_bb, kind.data.branch.true_args);
+            emitter << ", ";
+            DumpTarget(kind.data.branch.false_bb, kind.data.branch.false_args);
+            break;
+        case KOOPA_RVT_JUMP:
+            emitter << "jump ";
+            DumpTarget(kind.data.jump.target, kind.data.jump.args);
+            break;
+        case KOOPA_RVT_CALL:
+            emitter << "call " << kind.data.call.callee->name << "(";
+            DumpArgs(kind.data.call.args);
+            emitter << ")";
+            break;
+        case KOOPA_RVT_RETURN:
+            emitter << "ret";
+            if (kind.data.ret.value != nullptr)
+            {
+                emitter << " ";
+                DumpOperand(kind.data.ret.value);
+            }
+            break;
+        default:
+            assert(false);
+        }
+        emitter << '\n';
+    }
+    void DumpBlock(koopa_raw_basic_block_t bb)
+    {
+        emitter << bb->name;
+        if (bb->params.len != 0)
+        {
+            emitter << "(";
+            for (uint32_t i = 0; i < bb->params.len; i++)
+            {
+                koopa_raw_value_t param = reinterpret_cast<koopa_raw_value_t>(bb->params.buffer[i]);
+                if (i != 0)
+                {
+                    emitter << ", ";
+                }
+                DumpOperand(param);
+                emitter << ": ";
+                DumpType(param->ty);
+            }
+            emitter << ")";
+        }
+        emitter << ":\n";
+        for (uint32_t i = 0; i < bb->insts.len; i++)
+        {
+            DumpInst(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[i]));
+        }
+    }
+    void NumberValue(koopa_raw_value_t value)
+    {
+        if (value->ty->tag != KOOPA_RTT_UNIT && value->name == nullptr)
+        {
+            value_ids[value] = value_count++;
+        }
+    }
+    // 块参数作为实参时可能出现在定义它的块之前, 打印之前先按顺序给所有匿名的值编号
+    void NumberValues(koopa_raw_function_t func)
+    {
+        value_ids.clear();
+        value_count = 0;
+        for (uint32_t i = 0; i < func->bbs.len; i++)
+        {
+            koopa_raw_basic_block_t bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+            for (uint32_t j = 0; j < bb->params.len; j++)
+            {
+                NumberValue(reinterpret_cast<koopa_raw_value_t>(bb->params.buffer[j]));
+            }
+            for (uint32_t j = 0; j < bb->insts.len; j++)
+            {
+                NumberValue(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]));
+            }
+        }
+    }
+    void DumpFunction(koopa_raw_function_t func)
+    {
+        const auto &type = func->ty->data.function;
+        bool is_decl = (func->bbs.len == 0);
+        emitter << (is_decl ? "decl " : "fun ") << func->name << "(";
+        for (uint32_t i = 0; i < type.params.len; i++)
+        {
+            if (i != 0)
+            {
+                emitter << ", ";
+            }
+            if (!is_decl)
+            {
+                DumpOperand(reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]));
+                emitter << ": ";
+            }
+            DumpType(reinterpret_cast<koopa_raw_type_t>(type.params.buffer[i]));
+        }
+        emitter << ")";
+        if (type.ret->tag != KOOPA_RTT_UNIT)
+        {
+            emitter << ": ";
+            DumpType(type.ret);
+        }
+        if (is_decl)
+        {
+            emitter << '\n';
+            return;
+        }
+        emitter << " {\n";
+        NumberValues(func);
+        for (uint32_t i = 0; i < func->bbs.len; i++)
+        {
+            if (i != 0)
+            {
+                emitter << '\n';
+            }
+            DumpBlock(reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]));
+        }
+        emitter << "}\n\n";
+    }
+    void DumpGlobal(koopa_raw_value_t global)
+    {
+        koopa_raw_value_t init = global->kind.data.global_alloc.init;
+        emitter << "global " << global->name << " = alloc ";
+        DumpType(global->ty->data.pointer.base);
+        emitter << ", ";
+        if (init->kind.tag == KOOPA_RVT_ZERO_INIT)
+        {
+            emitter << "zeroinit";
+        }
+        else
+        {
+            DumpOperand(init);
+        }
+        emitter << '\n';
+    }
+public:
+    KoopaPrinter(Emitter &emitter) : emitter(emitter)
+    {
+    }
+    void Dump(const koopa_raw_program_t &program)
+    {
+        for (uint32_t i = 0; i < program.funcs.len; i++)
+        {
+            koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+            if (func->bbs.len == 0)
+            {
+                DumpFunction(func);
+            }
+        }
+        emitter << '\n';
+        for (uint32_t i = 0; i < program.values.len; i++)
+        {
+            DumpGlobal(reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]));
+        }
+        if (program.values.len != 0)
+        {
+            emitter << '\n';
+        }
+        for (uint32_t i = 0; i < program.funcs.len; i++)
+        {
+            koopa_raw_function_t func = reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]);
+            if (func->bbs.len != 0)
+            {
+                DumpFunction(func);
+            }
+        }
+    }
+};
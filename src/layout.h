@@ -0,0 +1,208 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+#include "mir.h"
+#include "regalloc.h"
+
+using namespace std;
+
+// 基本块布局: 按静态估计的边频率把基本块串成链, 同一条链中相邻的块之间直接落下去, 不需要跳转.
+// 边的频率按循环深度估计, 离开循环的边频率较低; 循环的回边优先成链, 循环头因此排在循环体之后,
+// 每次迭代只剩循环头的一条条件跳转. 布局之前每个块都以显式的跳转结束,
+// 多余的 j 和条件跳转的方向在栈帧布局之后由窥孔优化处理. 从入口不可达的块直接删除.
+
+typedef struct
+{
+    int from;
+    int to;
+    double weight;
+} layout_edge_t;
+
+class BlockLayout
+{
+private:
+    MachineFunction &mf;
+    vector<int> chain_of;
+    vector<vector<int> > chains;
+
+    // 不以 j / tail / ret 结尾的块补上跳到下一个块的 j, 之后块的顺序可以任意调整
+    void MakeJumpsExplicit()
+    {
+        for (size_t b = 0; b + 1 < mf.blocks.size(); b++)
+        {
+            machine_block_t &block = mf.blocks[b];
+            MachineOp last = block.insts.empty() ? MOP_NOP : block.insts.back().op;
+            if (last != MOP_J && last != MOP_TAIL && last != MOP_RET)
+            {
+                machine_inst_t j = MakeInst(MOP_J);
+                j.target = b + 1;
+                block.insts.push_back(j);
+            }
+        }
+    }
+    // 按 order 重排基本块并修改跳转目标, 不在 order 中的块被删除
+    void Reorder(const vector<int> &order)
+    {
+        vector<int> new_index(mf.blocks.size(), -1);
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            new_index[order[i]] = i;
+        }
+        vector<machine_block_t> blocks;
+        blocks.reserve(order.size());
+        for (int b: order)
+        {
+            blocks.push_back(mf.blocks[b]);
+            for (machine_inst_t &inst: blocks.back().insts)
+            {
+                if (inst.target >= 0)
+                {
+                    inst.target = new_index[inst.target];
+                }
+            }
+        }
+        mf.blocks.swap(blocks);
+        mf.ComputeSuccs();
+    }
+    void RemoveUnreachable()
+    {
+        vector<bool> reachable(mf.blocks.size(), false);
+        vector<int> stack = {0};
+        reachable[0] = true;
+        while (!stack.empty())
+        {
+            int b = stack.back();
+            stack.pop_back();
+            for (int succ: mf.blocks[b].succs)
+            {
+                if (!reachable[succ])
+                {
+                    reachable[succ] = true;
+                    stack.push_back(succ);
+                }
+            }
+        }
+        vector<int> order;
+        for (size_t b = 0; b < mf.blocks.size(); b++)
+        {
+            if (reachable[b])
+            {
+                order.push_back(b);
+            }
+        }
+        Reorder(order);
+    }
+    // 块的执行频率估计为 10 的循环深度次方, 平均分给各个后继, 离开循环的边再乘以 0.1.
+    // 频率相同时回边 (跳到原顺序中不靠后的块) 在前, 其余按原顺序
+    vector<layout_edge_t> EstimateEdges() const
+    {
+        vector<int> loop_depth = ComputeLoopDepth(mf);
+        vector<layout_edge_t> edges, back_edges;
+        for (size_t b = 0; b < mf.blocks.size(); b++)
+        {
+            vector<int> succs = mf.blocks[b].succs;
+            sort(succs.begin(), succs.end());
+            succs.erase(unique(succs.begin(), succs.end()), succs.end());
+            double freq = 1;
+            for (int i = 0; i < min(loop_depth[b], 8); i++)
+            {
+                freq *= 10;
+            }
+            for (int succ: succs)
+            {
+                layout_edge_t edge = {(int)b, succ, freq / succs.size()};
+                if (loop_depth[succ] < loop_depth[b])
+                {
+                    edge.weight *= 0.1;
+                }
+                (succ <= (int)b ? back_edges : edges).push_back(edge);
+            }
+        }
+        back_edges.insert(back_edges.end(), edges.begin(), edges.end());
+        stable_sort(back_edges.begin(), back_edges.end(), [](const layout_edge_t &lhs, const layout_edge_t &rhs)
+        {
+            return lhs.weight > rhs.weight;
+        });
+        return back_edges;
+    }
+    // 频率从高到低, 边的起点是所在链的末尾且终点是另一条链的开头时把两条链首尾相接
+    void BuildChains(const vector<layout_edge_t> &edges)
+    {
+        chain_of.resize(mf.blocks.size());
+        chains.resize(mf.blocks.size());
+        for (size_t b = 0; b < mf.blocks.size(); b++)
+        {
+            chain_of[b] = b;
+            chains[b] = {(int)b};
+        }
+        for (const layout_edge_t &edge: edges)
+        {
+            int from = chain_of[edge.from];
+            int to = chain_of[edge.to];
+            if (edge.to == 0 || from == to || chains[from].back() != edge.from || chains[to].front() != edge.to)
+            {
+                continue;
+            }
+            for (int b: chains[to])
+            {
+                chains[from].push_back(b);
+                chain_of[b] = from;
+            }
+            chains[to].clear();
+        }
+    }
+    // 入口所在的链排在最前, 之后每次选择与已放置的块之间频率最高的边指向的链
+    vector<int> OrderChains(const vector<layout_edge_t> &edges) const
+    {
+        vector<int> order;
+        vector<bool> placed(chains.size(), false);
+        size_t remaining = 0;
+        for (const vector<int> &chain: chains)
+        {
+            remaining += !chain.empty();
+        }
+        int next = chain_of[0];
+        while (remaining > 0)
+        {
+            placed[next] = true;
+            remaining--;
+            order.insert(order.end(), chains[next].begin(), chains[next].end());
+            next = -1;
+            for (const layout_edge_t &edge: edges)
+            {
+                int to = chain_of[edge.to];
+                if (placed[chain_of[edge.from]] && !placed[to])
+                {
+                    next = to;
+                    break;
+                }
+            }
+            for (size_t c = 0; c < chains.size() && next < 0; c++)
+            {
+                if (!placed[c] && !chains[c].empty())
+                {
+                    next = c;
+                }
+            }
+        }
+        return order;
+    }
+public:
+    BlockLayout(MachineFunction &mf) : mf(mf)
+    {
+    }
+    void Run()
+    {
+        mf.ComputeSuccs();
+        MakeJumpsExplicit();
+        RemoveUnreachable();
+        vector<layout_edge_t> edges = EstimateEdges();
+        BuildChains(edges);
+        Reorder(OrderChains(edges));
+    }
+};
+
+inline void LayoutBlocks(MachineFunction &mf)
+{
+    BlockLayout(mf).Run();
+}
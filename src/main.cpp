@@ -1,61 +1,192 @@
 #include <cassert>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <string.h>
-#include <fstream>
+#include <thread>
+#include <vector>
 #include "ast.h"
+#include "context.h"
+#include "emitter.h"
+#include "ir.h"
+#include "opt.h"
 #include "riscv.h"
+#include "stats.h"
+#include "thread_pool.h"
 #include "koopa.h"
 
 using namespace std;
 
-extern FILE *yyin;
-extern int yyparse(unique_ptr<BaseAST> &ast);
+typedef void *yyscan_t;
+extern int yylex_init_extra(CompilationContext *extra, yyscan_t *scanner);
+extern void yyset_in(FILE *in, yyscan_t scanner);
+extern int yylex_destroy(yyscan_t scanner);
+extern int yyparse(yyscan_t scanner, BaseAST *&ast);
 
-int main(int argc, const char *argv[])
+typedef struct
+{
+    const char *mode;
+    unsigned jobs;
+    int opt_level;
+    bool time_passes;
+    bool mem_report;
+    bool stats_json;
+} options_t;
+
+// 在当前线程上完成一个文件的编译, 所有状态都在这次编译自己的 CompilationContext 中;
+// codegen_jobs > 1 时各函数的目标代码在线程池上并行生成
+static void Compile(const options_t &options, const char *input, const char *output, unsigned codegen_jobs)
 {
-    assert(argc == 5);
-    auto mode = argv[1];
-    auto input = argv[2];
-    auto output = argv[4];
-
-    yyin = fopen(input, "r");
-    assert(yyin);
-    ofstream fout(output);
-    assert(fout);
-
-    unique_ptr<BaseAST> ast;
-    auto ret = yyparse(ast);
+    auto context = make_unique<CompilationContext>();
+    ctx = context.get();
+    ctx->codegen_jobs = codegen_jobs;
+    ctx->opt_level = options.opt_level;
+    PhaseTimer timer;
+
+    FILE *in = fopen(input, "r");
+    assert(in);
+    bool opened = ctx->emitter.Open(output);
+    assert(opened);
+
+    timer.Start("parse");
+    yyscan_t scanner;
+    yylex_init_extra(ctx, &scanner);
+    yyset_in(in, scanner);
+    BaseAST *ast = nullptr;
+    auto ret = yyparse(scanner, ast);
     assert(!ret);
+    yylex_destroy(scanner);
+    fclose(in);
+    timer.Stop();
 
-    streambuf *old_cout = cout.rdbuf(fout.rdbuf());
+    timer.Start("build-ir");
+    ast->BuildIR();
+    // IR 中的名字都是自己保存的副本, 生成 IR 后 AST 就可以整体释放了
+    ctx->ast_arena.Release();
+    timer.Stop();
 
-    if (strcmp(mode, "-koopa") == 0)
+    timer.Start("ir-opt");
+    OptimizeIR(ctx->ir_builder, ctx->opt_level);
+    koopa_raw_program_t raw = ctx->ir_builder.Finish();
+    timer.Stop();
+
+    if (strcmp(options.mode, "-koopa") == 0)
     {
-        ast->DumpIR();
+        timer.Start("koopa-print");
+        KoopaPrinter printer(ctx->emitter);
+        printer.Dump(raw);
+        timer.Stop();
     }
-    else if (strcmp(mode, "-riscv") == 0)
+    else if (strcmp(options.mode, "-riscv") == 0)
     {
-        stringstream ss;
-        cout.rdbuf(ss.rdbuf());
-        ast->DumpIR();
-        cout.rdbuf(fout.rdbuf());
-        koopa_program_t program;
-        koopa_error_code_t ret = koopa_parse_from_string((ss.str().c_str()), &program);
-        assert(ret == KOOPA_EC_SUCCESS); 
-        koopa_raw_program_builder_t builder = koopa_new_raw_program_builder();
-        koopa_raw_program_t raw = koopa_build_raw_program(builder, program);
-        koopa_delete_program(program);
-
+        timer.Start("riscv-codegen");
         Visit(raw);
+        timer.Stop();
+    }
 
-        koopa_delete_raw_program_builder(builder);
+    timer.Start("write");
+    ctx->emitter.Close();
+    timer.Stop();
+    ctx = nullptr;
+
+    if (options.time_passes || options.mem_report)
+    {
+        flockfile(stderr);
+        timer.Report(stderr, input, options.time_passes, options.mem_report, options.stats_json);
+        funlockfile(stderr);
     }
+}
 
-    cout.rdbuf(old_cout);
-    fout.close();
+// 批量模式下每个输入文件输出到 out_dir 下同名的 .koopa / .S 文件, 各文件在线程池上并行编译
+static void CompileBatch(const options_t &options, const string &out_dir, const vector<const char *> &inputs)
+{
+    const char *ext = (strcmp(options.mode, "-koopa") == 0) ? ".koopa" : ".S";
+    vector<string> outputs;
+    for (const char *input: inputs)
+    {
+        string name = input;
+        size_t slash = name.rfind('/');
+        if (slash != string::npos)
+        {
+            name = name.substr(slash + 1);
+        }
+        size_t dot = name.rfind('.');
+        if (dot != string::npos)
+        {
+            name = name.substr(0, dot);
+        }
+        outputs.push_back(out_dir + "/" + name + ext);
+    }
+    ThreadPool pool(options.jobs);
+    pool.Run(inputs.size(), [&](size_t i)
+    {
+        Compile(options, inputs[i], outputs[i].c_str(), 1);
+    });
+}
 
+// 单文件模式: compiler <mode> input -o output [options]
+// 批量模式:   compiler <mode> -batch <out_dir> [options] input...
+// options:    -O0 / -O1 / -O2  优化级别, 默认为 -O1; -O2 使用图着色寄存器分配
+//             -j N            单文件模式下并行生成目标代码的线程数, 批量模式下并行编译的文件数
+//             -time-passes    在 stderr 上报告每个阶段的墙钟时间和 CPU 时间
+//             -mem-report     在 stderr 上报告每个阶段结束时的峰值 RSS 和分配次数
+//             -stats-json     以 JSON 格式输出上面两种报告
+int main(int argc, const char *argv[])
+{
+    assert(argc >= 3);
+    options_t options = {argv[1], 0, 1, false, false, false};
+    bool batch = false;
+    const char *out_path = nullptr;
+    vector<const char *> inputs;
+    for (int i = 2; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-batch") == 0 && i + 1 < argc)
+        {
+            batch = true;
+            out_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            out_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc)
+        {
+            options.jobs = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-O0") == 0 || strcmp(argv[i], "-O1") == 0 || strcmp(argv[i], "-O2") == 0)
+        {
+            options.opt_level = argv[i][2] - '0';
+        }
+        else if (strcmp(argv[i], "-time-passes") == 0)
+        {
+            options.time_passes = true;
+        }
+        else if (strcmp(argv[i], "-mem-report") == 0)
+        {
+            options.mem_report = true;
+        }
+        else if (strcmp(argv[i], "-stats-json") == 0)
+        {
+            options.stats_json = true;
+        }
+        else
+        {
+            inputs.push_back(argv[i]);
+        }
+    }
+    assert(out_path != nullptr);
+    if (batch)
+    {
+        if (options.jobs == 0)
+        {
+            options.jobs = thread::hardware_concurrency();
+        }
+        CompileBatch(options, out_path, inputs);
+        return 0;
+    }
+    assert(inputs.size() == 1);
+    Compile(options, inputs[0], out_path, max(options.jobs, 1u));
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,252 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include "cfg.h"
+#include "ir.h"
+#include "koopa.h"
+
+using namespace std;
+
+// 把只被 load / store 直接使用的 alloc 提升为 SSA 值, 用基本块参数代替 phi.
+// 参数放在变量定值块的迭代支配边界上, 只考虑在某个块中先读后写的变量 (semi-pruned SSA),
+// 只在块内先写后读的临时变量不需要参数. 之后沿支配树先序重命名: 每个变量维护一个当前值的栈,
+// load 替换为栈顶的值, 跳转到有参数的块时把各变量的当前值作为实参传过去, 没有定值就读取的变量按 0 处理.
+// 最后反复删除所有实参都相同 (或就是参数自己) 的块参数, 没有用到的参数留给死代码删除处理.
+
+class Mem2Reg
+{
+private:
+    IRBuilder &builder;
+    IRFunction *func;
+    // 可以提升的 alloc, 构建期间 alloc 的 index 暂时记录它在这里的下标, 不能提升的为 -1
+    vector<IRValue *> allocs;
+    // 每个基本块中为哪些变量放置了参数, 与 param_list 中新增的参数一一对应
+    vector<vector<pair<int, koopa_raw_value_t> > > block_params;
+    vector<vector<koopa_raw_value_t> > stacks;
+    value_map_t replaced;
+    koopa_raw_value_t zero = nullptr;
+
+    int AllocId(koopa_raw_value_t value) const
+    {
+        return value->kind.tag == KOOPA_RVT_ALLOC ? ValueIndex(value) : -1;
+    }
+    koopa_raw_value_t Zero()
+    {
+        if (zero == nullptr)
+        {
+            zero = builder.Integer(0);
+        }
+        return zero;
+    }
+    koopa_raw_value_t Current(int alloc)
+    {
+        return stacks[alloc].empty() ? Zero() : stacks[alloc].back();
+    }
+    // 地址被用作 load / store 以外的操作数 (例如被 store 到别处) 的 alloc 不能提升
+    void FindPromotable()
+    {
+        vector<IRValue *> candidates;
+        for (const void *bb: func->bb_list)
+        {
+            for (const void *ptr: AsIRBlock(bb)->inst_list)
+            {
+                IRValue *inst = AsIRValue(ptr);
+                if (inst->kind.tag == KOOPA_RVT_ALLOC)
+                {
+                    inst->index = candidates.size();
+                    candidates.push_back(inst);
+                }
+            }
+        }
+        vector<bool> escaped(candidates.size(), false);
+        for (const void *bb: func->bb_list)
+        {
+            for (const void *ptr: AsIRBlock(bb)->inst_list)
+            {
+                IRValue *inst = AsIRValue(ptr);
+                ForEachIROperand(inst, [&](koopa_raw_value_t &operand)
+                {
+                    int id = AllocId(operand);
+                    bool is_address = inst->kind.tag == KOOPA_RVT_LOAD || (inst->kind.tag == KOOPA_RVT_STORE && &operand == &inst->kind.data.store.dest);
+                    if (id >= 0 && !is_address)
+                    {
+                        escaped[id] = true;
+                    }
+                });
+            }
+        }
+        for (size_t i = 0; i < candidates.size(); i++)
+        {
+            candidates[i]->index = escaped[i] ? -1 : (int)allocs.size();
+            if (!escaped[i])
+            {
+                allocs.push_back(candidates[i]);
+            }
+        }
+    }
+    void PlaceParams(const IRCfg &cfg, const vector<vector<int> > &frontiers)
+    {
+        size_t block_num = cfg.blocks.size();
+        vector<vector<int> > def_blocks(allocs.size());
+        vector<bool> live_in(allocs.size(), false);
+        vector<int> last_store(allocs.size(), -1);
+        for (size_t b = 0; b < block_num; b++)
+        {
+            for (const void *ptr: cfg.blocks[b]->inst_list)
+            {
+                const IRValue *inst = AsIRValue(ptr);
+                if (inst->kind.tag == KOOPA_RVT_LOAD)
+                {
+                    int id = AllocId(inst->kind.data.load.src);
+                    if (id >= 0 && last_store[id] != (int)b)
+                    {
+                        live_in[id] = true;
+                    }
+                }
+                else if (inst->kind.tag == KOOPA_RVT_STORE)
+                {
+                    int id = AllocId(inst->kind.data.store.dest);
+                    if (id >= 0 && last_store[id] != (int)b)
+                    {
+                        last_store[id] = b;
+                        def_blocks[id].push_back(b);
+                    }
+                }
+            }
+        }
+        block_params.assign(block_num, {});
+        vector<int> has_param(block_num, -1);
+        vector<int> is_def(block_num, -1);
+        for (size_t id = 0; id < allocs.size(); id++)
+        {
+            if (!live_in[id])
+            {
+                continue;
+            }
+            vector<int> worklist = def_blocks[id];
+            for (int b: worklist)
+            {
+                is_def[b] = id;
+            }
+            while (!worklist.empty())
+            {
+                int b = worklist.back();
+                worklist.pop_back();
+                for (int y: frontiers[b])
+                {
+                    if (has_param[y] == (int)id)
+                    {
+                        continue;
+                    }
+                    has_param[y] = id;
+                    block_params[y].push_back(make_pair(id, builder.BlockParam(cfg.blocks[y])));
+                    if (is_def[y] != (int)id)
+                    {
+                        is_def[y] = id;
+                        worklist.push_back(y);
+                    }
+                }
+            }
+        }
+    }
+    void RenameBlock(IRBasicBlock *bb, vector<int> &defined)
+    {
+        for (auto &param: block_params[bb->index])
+        {
+            stacks[param.first].push_back(param.second);
+            defined.push_back(param.first);
+        }
+        vector<const void *> insts;
+        for (const void *ptr: bb->inst_list)
+        {
+            IRValue *inst = AsIRValue(ptr);
+            ForEachIROperand(inst, [&](koopa_raw_value_t &operand)
+            {
+                auto it = replaced.find(operand);
+                if (it != replaced.end())
+                {
+                    operand = it->second;
+                }
+            });
+            const auto &kind = inst->kind;
+            if (kind.tag == KOOPA_RVT_LOAD && AllocId(kind.data.load.src) >= 0)
+            {
+                replaced[inst] = Current(AllocId(kind.data.load.src));
+            }
+            else if (kind.tag == KOOPA_RVT_STORE && AllocId(kind.data.store.dest) >= 0)
+            {
+                stacks[AllocId(kind.data.store.dest)].push_back(kind.data.store.value);
+                defined.push_back(AllocId(kind.data.store.dest));
+            }
+            else if (AllocId(inst) < 0)
+            {
+                insts.push_back(inst);
+            }
+        }
+        bb->inst_list.swap(insts);
+        ForEachSuccessor(bb, [&](IRBasicBlock *succ, vector<const void *> &args)
+        {
+            for (auto &param: block_params[succ->index])
+            {
+                args.push_back(Current(param.first));
+            }
+        });
+    }
+    // 沿支配树先序遍历, 离开一个块时弹出它压入各个栈的值
+    void Rename(const IRCfg &cfg, const vector<int> &idom)
+    {
+        vector<vector<int> > children(cfg.blocks.size());
+        for (size_t b = 1; b < cfg.blocks.size(); b++)
+        {
+            children[idom[b]].push_back(b);
+        }
+        stacks.assign(allocs.size(), {});
+        vector<int> defined;
+        // 第二个元素为 -1 表示进入块, 否则表示离开块, 记录进入时 defined 的长度
+        vector<pair<int, int> > stack = {make_pair(0, -1)};
+        while (!stack.empty())
+        {
+            pair<int, int> top = stack.back();
+            stack.pop_back();
+            if (top.second >= 0)
+            {
+                while ((int)defined.size() > top.second)
+                {
+                    stacks[defined.back()].pop_back();
+                    defined.pop_back();
+                }
+                continue;
+            }
+            stack.push_back(make_pair(top.first, (int)defined.size()));
+            RenameBlock(cfg.blocks[top.first], defined);
+            for (auto it = children[top.first].rbegin(); it != children[top.first].rend(); ++it)
+            {
+                stack.push_back(make_pair(*it, -1));
+            }
+        }
+    }
+public:
+    Mem2Reg(IRBuilder &builder, IRFunction *func) : builder(builder), func(func)
+    {
+    }
+    bool Run()
+    {
+        RemoveUnreachableBlocks(func);
+        FindPromotable();
+        if (allocs.empty())
+        {
+            return false;
+        }
+        IRCfg cfg(func);
+        vector<int> idom = ComputeIdom(cfg.succs, cfg.preds, 0);
+        PlaceParams(cfg, ComputeFrontiers(cfg.preds, idom));
+        Rename(cfg, idom);
+        RemoveTrivialParams(builder, func);
+        return true;
+    }
+};
+
+inline bool PromoteAllocs(IRBuilder &builder, IRFunction *func)
+{
+    return Mem2Reg(builder, func).Run();
+}
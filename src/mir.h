@@ -0,0 +1,374 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "emitter.h"
+#include "frame.h"
+
+using namespace std;
+
+// 目标代码先生成为 MachineFunction 中的机器指令序列 (使用虚拟寄存器),
+// 经过寄存器分配和栈帧布局之后再由 MachinePrinter 输出为汇编文本.
+
+// 物理寄存器按 x0 - x31 编号, 编号不小于 VREG_BASE 的是虚拟寄存器
+#define PHYS_REG_NUM 32
+#define VREG_BASE 32
+#define NO_REG (-1)
+
+enum MachineReg{REG_ZERO = 0, REG_RA = 1, REG_SP = 2, REG_GP = 3, REG_TP = 4,
+                REG_T0 = 5, REG_T1 = 6, REG_T2 = 7, REG_S0 = 8, REG_S1 = 9,
+                REG_A0 = 10, REG_A1, REG_A2, REG_A3, REG_A4, REG_A5, REG_A6, REG_A7,
+                REG_S2 = 18, REG_S3, REG_S4, REG_S5, REG_S6, REG_S7, REG_S8, REG_S9, REG_S10, REG_S11,
+                REG_T3 = 28, REG_T4 = 29, REG_T5 = 30, REG_T6 = 31};
+
+// t5 / t6 不参与寄存器分配, 留给溢出变量的读写和大偏移量的地址计算
+#define SCRATCH_REG1 REG_T5
+#define SCRATCH_REG2 REG_T6
+#define PARAM_REG_NUM 8
+
+static const char *const reg_names[PHYS_REG_NUM] = {
+    "zero", "ra", "sp", "gp", "tp", "t0", "t1", "t2", "s0", "s1", "a0", "a1", "a2", "a3", "a4", "a5",
+    "a6", "a7", "s2", "s3", "s4", "s5", "s6", "s7", "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"};
+
+// 能否作为 I 型指令的 12 位有符号立即数
+inline bool IsImm12(int64_t value)
+{
+    return value >= -2048 && value < 2048;
+}
+
+inline bool IsVirtualReg(int reg)
+{
+    return reg >= VREG_BASE;
+}
+
+inline bool IsCalleeSaved(int reg)
+{
+    return reg == REG_S0 || reg == REG_S1 || (reg >= REG_S2 && reg <= REG_S11);
+}
+
+inline bool IsCallerSaved(int reg)
+{
+    return (reg >= REG_T0 && reg <= REG_T2) || (reg >= REG_A0 && reg <= REG_A7) || reg >= REG_T3;
+}
+
+enum MachineOp{
+    // rd, rs1, rs2
+    MOP_ADD, MOP_SUB, MOP_MUL, MOP_MULH, MOP_DIV, MOP_REM, MOP_AND, MOP_OR, MOP_XOR, MOP_SLT, MOP_SGT,
+    // rd, rs1, imm
+    MOP_ADDI, MOP_ANDI, MOP_ORI, MOP_XORI, MOP_SLTI, MOP_SLLI, MOP_SRLI, MOP_SRAI,
+    // rd, rs1
+    MOP_SEQZ, MOP_SNEZ, MOP_MV,
+    // rd, imm
+    MOP_LI,
+    // lui rd, %hi(g_imm), 全局变量地址的高 20 位
+    MOP_LUI,
+    // lw rd, imm(rs1) / sw rs2, imm(rs1); frame_index >= 0 时基址是栈帧对象,
+    // global_id >= 0 时偏移量是 %lo(g_global_id), 基址是对应的 lui 的结果
+    MOP_LW, MOP_SW,
+    // bnez / beqz rs1, target; beq / bne / blt / bge rs1, rs2, target; j target
+    MOP_BNEZ, MOP_BEQZ, MOP_BEQ, MOP_BNE, MOP_BLT, MOP_BGE, MOP_J,
+    // call symbol, imm 为用寄存器传递的参数个数
+    MOP_CALL,
+    // tail symbol, 拆除栈帧后直接跳转到 symbol, imm 与 call 相同
+    MOP_TAIL,
+    // ret, imm 为 1 时返回 a0
+    MOP_RET,
+    // 已被删除的指令, 在窥孔优化结束时清除
+    MOP_NOP
+};
+
+static const char *const mop_names[] = {
+    "add", "sub", "mul", "mulh", "div", "rem", "and", "or", "xor", "slt", "sgt",
+    "addi", "andi", "ori", "xori", "slti", "slli", "srli", "srai",
+    "seqz", "snez", "mv",
+    "li",
+    "lui",
+    "lw", "sw",
+    "bnez", "beqz", "beq", "bne", "blt", "bge", "j",
+    "call",
+    "tail",
+    "ret",
+    "nop"};
+
+typedef struct
+{
+    MachineOp op;
+    int rd;
+    int rs1;
+    int rs2;
+    int32_t imm;
+    int frame_index;
+    int global_id;
+    int target;
+    const char *symbol;
+} machine_inst_t;
+
+inline machine_inst_t MakeInst(MachineOp op, int rd = NO_REG, int rs1 = NO_REG, int rs2 = NO_REG, int32_t imm = 0)
+{
+    machine_inst_t inst;
+    inst.op = op;
+    inst.rd = rd;
+    inst.rs1 = rs1;
+    inst.rs2 = rs2;
+    inst.imm = imm;
+    inst.frame_index = -1;
+    inst.global_id = -1;
+    inst.target = -1;
+    inst.symbol = nullptr;
+    return inst;
+}
+
+// 指令读写的寄存器. call 读参数寄存器并破坏所有 caller-saved 寄存器, tail 只读参数寄存器, ret 读返回值 a0
+inline void GetDefsUses(const machine_inst_t &inst, vector<int> &defs, vector<int> &uses)
+{
+    defs.clear();
+    uses.clear();
+    switch (inst.op)
+    {
+    case MOP_CALL:
+        for (int i = 0; i < inst.imm; i++)
+        {
+            uses.push_back(REG_A0 + i);
+        }
+        for (int reg = 0; reg < PHYS_REG_NUM; reg++)
+        {
+            if (IsCallerSaved(reg))
+            {
+                defs.push_back(reg);
+            }
+        }
+        defs.push_back(REG_RA);
+        return;
+    case MOP_TAIL:
+        for (int i = 0; i < inst.imm; i++)
+        {
+            uses.push_back(REG_A0 + i);
+        }
+        return;
+    case MOP_RET:
+        if (inst.imm)
+        {
+            uses.push_back(REG_A0);
+        }
+        return;
+    case MOP_SW:
+        uses.push_back(inst.rs2);
+        if (inst.frame_index < 0)
+        {
+            uses.push_back(inst.rs1);
+        }
+        return;
+    case MOP_LW:
+        defs.push_back(inst.rd);
+        if (inst.frame_index < 0)
+        {
+            uses.push_back(inst.rs1);
+        }
+        return;
+    default:
+        break;
+    }
+    if (inst.rd != NO_REG)
+    {
+        defs.push_back(inst.rd);
+    }
+    if (inst.rs1 != NO_REG)
+    {
+        uses.push_back(inst.rs1);
+    }
+    if (inst.rs2 != NO_REG)
+    {
+        uses.push_back(inst.rs2);
+    }
+}
+
+// 条件相反的条件跳转
+inline MachineOp InvertBranch(MachineOp op)
+{
+    switch (op)
+    {
+    case MOP_BNEZ:
+        return MOP_BEQZ;
+    case MOP_BEQZ:
+        return MOP_BNEZ;
+    case MOP_BEQ:
+        return MOP_BNE;
+    case MOP_BNE:
+        return MOP_BEQ;
+    case MOP_BLT:
+        return MOP_BGE;
+    case MOP_BGE:
+        return MOP_BLT;
+    default:
+        assert(false);
+        return op;
+    }
+}
+
+typedef struct
+{
+    string name;
+    vector<machine_inst_t> insts;
+    vector<int> succs;
+} machine_block_t;
+
+class MachineFunction
+{
+public:
+    const char *name;
+    vector<machine_block_t> blocks;
+    int vreg_count = 0;
+    StackFrame frame;
+
+    int NewVReg()
+    {
+        return VREG_BASE + vreg_count++;
+    }
+    int NewBlock(const string &block_name)
+    {
+        machine_block_t block;
+        block.name = block_name;
+        blocks.push_back(block);
+        return blocks.size() - 1;
+    }
+    void Emit(int block, const machine_inst_t &inst)
+    {
+        blocks[block].insts.push_back(inst);
+    }
+    // 不调用其它函数的叶函数. 尾调用不会返回到本函数, 不影响叶函数的判断
+    bool IsLeaf() const
+    {
+        for (const machine_block_t &block: blocks)
+        {
+            for (const machine_inst_t &inst: block.insts)
+            {
+                if (inst.op == MOP_CALL)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+    // 根据块中的跳转指令计算后继, 不以 j / tail / ret 结尾的块还会落到下一个块
+    void ComputeSuccs()
+    {
+        for (size_t b = 0; b < blocks.size(); b++)
+        {
+            machine_block_t &block = blocks[b];
+            block.succs.clear();
+            for (const machine_inst_t &inst: block.insts)
+            {
+                if (inst.target >= 0)
+                {
+                    block.succs.push_back(inst.target);
+                }
+            }
+            bool falls_through = block.insts.empty() || (block.insts.back().op != MOP_J && block.insts.back().op != MOP_TAIL && block.insts.back().op != MOP_RET);
+            if (falls_through && b + 1 < blocks.size())
+            {
+                block.succs.push_back(b + 1);
+            }
+        }
+    }
+};
+
+class MachinePrinter
+{
+private:
+    Emitter &emitter;
+
+    void PrintMem(const machine_inst_t &inst, int reg)
+    {
+        assert(inst.frame_index < 0);
+        emitter << "  " << mop_names[inst.op] << ' ' << reg_names[reg] << ", ";
+        if (inst.global_id >= 0)
+        {
+            emitter << "%lo(g_" << inst.global_id << ')';
+        }
+        else
+        {
+            emitter << inst.imm;
+        }
+        emitter << '(' << reg_names[inst.rs1] << ")\n";
+    }
+public:
+    MachinePrinter(Emitter &emitter) : emitter(emitter)
+    {
+    }
+    void PrintInst(const MachineFunction &mf, const machine_inst_t &inst)
+    {
+        const char *name = mop_names[inst.op];
+        switch (inst.op)
+        {
+        case MOP_ADDI:
+        case MOP_ANDI:
+        case MOP_ORI:
+        case MOP_XORI:
+        case MOP_SLTI:
+        case MOP_SLLI:
+        case MOP_SRLI:
+        case MOP_SRAI:
+            emitter << "  " << name << ' ' << reg_names[inst.rd] << ", " << reg_names[inst.rs1] << ", " << inst.imm << '\n';
+            break;
+        case MOP_SEQZ:
+        case MOP_SNEZ:
+        case MOP_MV:
+            emitter << "  " << name << ' ' << reg_names[inst.rd] << ", " << reg_names[inst.rs1] << '\n';
+            break;
+        case MOP_LI:
+            emitter << "  li " << reg_names[inst.rd] << ", " << inst.imm << '\n';
+            break;
+        case MOP_LUI:
+            emitter << "  lui " << reg_names[inst.rd] << ", %hi(g_" << inst.imm << ")\n";
+            break;
+        case MOP_LW:
+            PrintMem(inst, inst.rd);
+            break;
+        case MOP_SW:
+            PrintMem(inst, inst.rs2);
+            break;
+        case MOP_BNEZ:
+        case MOP_BEQZ:
+            emitter << "  " << name << ' ' << reg_names[inst.rs1] << ", " << mf.blocks[inst.target].name << '\n';
+            break;
+        case MOP_BEQ:
+        case MOP_BNE:
+        case MOP_BLT:
+        case MOP_BGE:
+            emitter << "  " << name << ' ' << reg_names[inst.rs1] << ", " << reg_names[inst.rs2] << ", " << mf.blocks[inst.target].name << '\n';
+            break;
+        case MOP_J:
+            emitter << "  j " << mf.blocks[inst.target].name << '\n';
+            break;
+        case MOP_CALL:
+        case MOP_TAIL:
+            emitter << "  " << name << ' ' << inst.symbol << '\n';
+            break;
+        case MOP_RET:
+            emitter << "  ret\n";
+            break;
+        case MOP_NOP:
+            break;
+        default:
+            emitter << "  " << name << ' ' << reg_names[inst.rd] << ", " << reg_names[inst.rs1] << ", " << reg_names[inst.rs2] << '\n';
+            break;
+        }
+    }
+    void Print(const MachineFunction &mf)
+    {
+        emitter << "  .globl " << mf.name << '\n';
+        emitter << mf.name << ":\n";
+        for (size_t i = 0; i < mf.blocks.size(); i++)
+        {
+            const machine_block_t &block = mf.blocks[i];
+            emitter << block.name << ":\n";
+            for (const machine_inst_t &inst: block.insts)
+            {
+                PrintInst(mf, inst);
+            }
+        }
+        emitter << '\n';
+    }
+};
@@ -0,0 +1,117 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "dce.h"
+#include "ir.h"
+#include "koopa.h"
+#include "mem2reg.h"
+#include "sccp.h"
+
+using namespace std;
+
+// Finish() 之前在内存形式的 Koopa IR 上做的优化. 各个 pass 直接修改函数和基本块中的 vector,
+// 这时 slice 还没有写回, 调用的实参要从 IRValue::arg_list 中读取.
+
+// 以 call @func(...); ret 结尾, 并且直接返回这次调用结果的基本块
+inline bool IsSelfTailCall(const IRFunction *func, const IRBasicBlock *bb)
+{
+    size_t n = bb->inst_list.size();
+    if (n < 2)
+    {
+        return false;
+    }
+    const IRValue *call = AsIRValue(bb->inst_list[n - 2]);
+    const IRValue *ret = AsIRValue(bb->inst_list[n - 1]);
+    if (call->kind.tag != KOOPA_RVT_CALL || ret->kind.tag != KOOPA_RVT_RETURN || call->kind.data.call.callee != func)
+    {
+        return false;
+    }
+    koopa_raw_value_t value = ret->kind.data.ret.value;
+    return value == call || (value == nullptr && call->ty->tag == KOOPA_RTT_UNIT);
+}
+
+// 自尾递归消除. 前端在入口块中为每个形参 alloc 一个变量并 store 进去, 这些指令和入口块中的其它 alloc 留在入口块,
+// 其余指令移到新的循环头 %tail_entry_xxx 中; 尾递归调用改为把实参 store 到形参的变量中, 再跳回循环头.
+// 实参在调用之前都已经求值, 依次 store 不会互相影响.
+inline bool EliminateTailRecursion(IRBuilder &builder, IRFunction *func)
+{
+    bool found = false;
+    for (const void *bb: func->bb_list)
+    {
+        found |= IsSelfTailCall(func, AsIRBlock(bb));
+    }
+    if (!found)
+    {
+        return false;
+    }
+    IRBasicBlock *entry = AsIRBlock(func->bb_list[0]);
+    vector<koopa_raw_value_t> param_vars(func->param_list.size(), nullptr);
+    vector<const void *> entry_insts, header_insts;
+    for (const void *ptr: entry->inst_list)
+    {
+        const IRValue *inst = AsIRValue(ptr);
+        if (inst->kind.tag == KOOPA_RVT_STORE && inst->kind.data.store.value->kind.tag == KOOPA_RVT_FUNC_ARG_REF)
+        {
+            param_vars[inst->kind.data.store.value->kind.data.func_arg_ref.index] = inst->kind.data.store.dest;
+            entry_insts.push_back(inst);
+        }
+        else if (inst->kind.tag == KOOPA_RVT_ALLOC)
+        {
+            entry_insts.push_back(inst);
+        }
+        else
+        {
+            header_insts.push_back(inst);
+        }
+    }
+    for (koopa_raw_value_t var: param_vars)
+    {
+        if (var == nullptr)
+        {
+            return false;
+        }
+    }
+    IRBasicBlock *header = builder.NewBlock(string("%tail_") + (entry->name + 1));
+    header->inst_list.swap(header_insts);
+    entry->inst_list.swap(entry_insts);
+    builder.SetInsertPoint(entry);
+    builder.Jump(header);
+    func->bb_list.insert(func->bb_list.begin() + 1, header);
+    for (const void *ptr: func->bb_list)
+    {
+        IRBasicBlock *bb = AsIRBlock(ptr);
+        if (!IsSelfTailCall(func, bb))
+        {
+            continue;
+        }
+        const IRValue *call = AsIRValue(bb->inst_list[bb->inst_list.size() - 2]);
+        bb->inst_list.resize(bb->inst_list.size() - 2);
+        builder.SetInsertPoint(bb);
+        for (size_t i = 0; i < param_vars.size(); i++)
+        {
+            builder.Store(reinterpret_cast<koopa_raw_value_t>(call->arg_list[i]), param_vars[i]);
+        }
+        builder.Jump(header);
+    }
+    return true;
+}
+
+// 按优化级别依次在每个函数上运行 IR 优化, -O0 时保持前端生成的 IR 不变
+inline void OptimizeIR(IRBuilder &builder, int opt_level)
+{
+    if (opt_level < 1)
+    {
+        return;
+    }
+    for (const auto &func: builder.Functions())
+    {
+        if (func->bb_list.empty())
+        {
+            continue;
+        }
+        EliminateTailRecursion(builder, func.get());
+        PromoteAllocs(builder, func.get());
+        PropagateConstants(builder, func.get());
+        EliminateDeadCode(func.get());
+    }
+}
@@ -0,0 +1,285 @@
+#pragma once
+#include <vector>
+#include "mir.h"
+#include "regalloc.h"
+
+using namespace std;
+
+// 寄存器分配和栈帧布局之后, 在机器指令序列上做窥孔优化.
+// 每条规则在某个位置尝试匹配一小段相邻的指令, 匹配成功时原地改写, 删除的指令先改为 MOP_NOP.
+// 所有规则反复执行直到不再有变化, 最后清除 MOP_NOP.
+
+class Peephole;
+
+// 在 block 的第 i 条指令处尝试一条规则, 改写了指令时返回 true
+typedef bool (*peephole_rule_t)(Peephole &peephole, machine_block_t &block, size_t i);
+
+class Peephole
+{
+private:
+    MachineFunction &mf;
+    Liveness liveness;
+    size_t cur_block = 0;
+public:
+    Peephole(MachineFunction &mf) : mf(mf)
+    {
+    }
+    size_t BlockIndex() const
+    {
+        return cur_block;
+    }
+    static void Delete(machine_inst_t &inst)
+    {
+        inst = MakeInst(MOP_NOP);
+    }
+    // 第 i 条之后的第一条未被删除的指令, 没有时返回 insts.size()
+    static size_t Next(const machine_block_t &block, size_t i)
+    {
+        for (i++; i < block.insts.size() && block.insts[i].op == MOP_NOP; i++)
+        {
+        }
+        return i;
+    }
+    // 第 i 条指令之后 reg 的值是否不会再被读取
+    bool DeadAfter(const machine_block_t &block, size_t i, int reg)
+    {
+        vector<int> defs, uses;
+        for (size_t k = Next(block, i); k < block.insts.size(); k = Next(block, k))
+        {
+            GetDefsUses(block.insts[k], defs, uses);
+            for (int use: uses)
+            {
+                if (use == reg)
+                {
+                    return false;
+                }
+            }
+            for (int def: defs)
+            {
+                if (def == reg)
+                {
+                    return true;
+                }
+            }
+        }
+        return !IsAllocatable(reg) || !liveness.live_out[cur_block].Test(reg);
+    }
+    void Run(const peephole_rule_t *rules, size_t rule_num)
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            mf.ComputeSuccs();
+            liveness.Compute(mf);
+            for (cur_block = 0; cur_block < mf.blocks.size(); cur_block++)
+            {
+                machine_block_t &block = mf.blocks[cur_block];
+                for (size_t i = 0; i < block.insts.size(); i++)
+                {
+                    // 同一位置反复尝试, 直到没有规则能匹配或这条指令被删除
+                    bool matched = true;
+                    while (matched && block.insts[i].op != MOP_NOP)
+                    {
+                        matched = false;
+                        for (size_t r = 0; r < rule_num && !matched; r++)
+                        {
+                            matched = rules[r](*this, block, i);
+                        }
+                        changed |= matched;
+                    }
+                }
+            }
+        }
+        for (machine_block_t &block: mf.blocks)
+        {
+            vector<machine_inst_t> insts;
+            insts.reserve(block.insts.size());
+            for (const machine_inst_t &inst: block.insts)
+            {
+                if (inst.op != MOP_NOP)
+                {
+                    insts.push_back(inst);
+                }
+            }
+            block.insts.swap(insts);
+        }
+    }
+};
+
+// mv r, r
+inline bool RuleRedundantMove(Peephole &peephole, machine_block_t &block, size_t i)
+{
+    machine_inst_t &inst = block.insts[i];
+    if (inst.op == MOP_MV && inst.rd == inst.rs1)
+    {
+        Peephole::Delete(inst);
+        return true;
+    }
+    return false;
+}
+
+// add / sub / or / xor d, s, zero, add / or / xor d, zero, s 以及 addi d, s, 0 => mv d, s
+inline bool RuleZeroOperand(Peephole &peephole, machine_block_t &block, size_t i)
+{
+    machine_inst_t &inst = block.insts[i];
+    if (inst.op == MOP_ADDI && inst.imm == 0 && inst.rd != REG_SP)
+    {
+        inst = MakeInst(MOP_MV, inst.rd, inst.rs1);
+        return true;
+    }
+    bool commutative = inst.op == MOP_ADD || inst.op == MOP_OR || inst.op == MOP_XOR;
+    if (!commutative && inst.op != MOP_SUB)
+    {
+        return false;
+    }
+    if (inst.rs2 == REG_ZERO)
+    {
+        inst = MakeInst(MOP_MV, inst.rd, inst.rs1);
+        return true;
+    }
+    if (commutative && inst.rs1 == REG_ZERO)
+    {
+        inst = MakeInst(MOP_MV, inst.rd, inst.rs2);
+        return true;
+    }
+    return false;
+}
+
+// sw x, imm(b); lw y, imm(b) => sw x, imm(b); mv y, x
+inline bool RuleStoreLoad(Peephole &peephole, machine_block_t &block, size_t i)
+{
+    const machine_inst_t &store = block.insts[i];
+    size_t j = Peephole::Next(block, i);
+    if (store.op != MOP_SW || j >= block.insts.size())
+    {
+        return false;
+    }
+    machine_inst_t &load = block.insts[j];
+    if (load.op != MOP_LW || load.rs1 != store.rs1 || load.imm != store.imm || load.global_id != store.global_id)
+    {
+        return false;
+    }
+    load = MakeInst(MOP_MV, load.rd, store.rs2);
+    return true;
+}
+
+// li r, 0; op ..., r, ... 且 r 之后不再被读取 => op ..., zero, ...
+inline bool RuleLoadZero(Peephole &peephole, machine_block_t &block, size_t i)
+{
+    machine_inst_t &li = block.insts[i];
+    size_t j = Peephole::Next(block, i);
+    if (li.op != MOP_LI || li.imm != 0 || j >= block.insts.size())
+    {
+        return false;
+    }
+    machine_inst_t &user = block.insts[j];
+    if (user.op == MOP_CALL || user.op == MOP_TAIL || user.op == MOP_RET || (user.rs1 != li.rd && user.rs2 != li.rd))
+    {
+        return false;
+    }
+    if (user.rd != li.rd && !peephole.DeadAfter(block, j, li.rd))
+    {
+        return false;
+    }
+    if (user.rs1 == li.rd)
+    {
+        user.rs1 = REG_ZERO;
+    }
+    if (user.rs2 == li.rd)
+    {
+        user.rs2 = REG_ZERO;
+    }
+    Peephole::Delete(li);
+    return true;
+}
+
+// seqz t, x; bnez t, L => beqz x, L
+// snez t, x; bnez t, L => bnez x, L
+inline bool RuleBranchOnSetZero(Peephole &peephole, machine_block_t &block, size_t i)
+{
+    machine_inst_t &set = block.insts[i];
+    size_t j = Peephole::Next(block, i);
+    if ((set.op != MOP_SEQZ && set.op != MOP_SNEZ) || j >= block.insts.size())
+    {
+        return false;
+    }
+    machine_inst_t &branch = block.insts[j];
+    if (branch.op != MOP_BNEZ || branch.rs1 != set.rd || !peephole.DeadAfter(block, j, set.rd))
+    {
+        return false;
+    }
+    branch.op = (set.op == MOP_SEQZ) ? MOP_BEQZ : MOP_BNEZ;
+    branch.rs1 = set.rs1;
+    Peephole::Delete(set);
+    return true;
+}
+
+// xor t, a, b; beqz t, L => beq a, b, L
+// xor t, a, b; bnez t, L => bne a, b, L
+inline bool RuleBranchOnXor(Peephole &peephole, machine_block_t &block, size_t i)
+{
+    machine_inst_t &xor_inst = block.insts[i];
+    size_t j = Peephole::Next(block, i);
+    if (xor_inst.op != MOP_XOR || j >= block.insts.size())
+    {
+        return false;
+    }
+    machine_inst_t &branch = block.insts[j];
+    if ((branch.op != MOP_BEQZ && branch.op != MOP_BNEZ) || branch.rs1 != xor_inst.rd || !peephole.DeadAfter(block, j, xor_inst.rd))
+    {
+        return false;
+    }
+    branch.op = (branch.op == MOP_BEQZ) ? MOP_BEQ : MOP_BNE;
+    branch.rs1 = xor_inst.rs1;
+    branch.rs2 = xor_inst.rs2;
+    Peephole::Delete(xor_inst);
+    return true;
+}
+
+// 块末尾跳到紧随其后的块的 j
+inline bool RuleJumpToNext(Peephole &peephole, machine_block_t &block, size_t i)
+{
+    machine_inst_t &inst = block.insts[i];
+    if (inst.op == MOP_J && Peephole::Next(block, i) == block.insts.size() && inst.target == (int)peephole.BlockIndex() + 1)
+    {
+        Peephole::Delete(inst);
+        return true;
+    }
+    return false;
+}
+
+// bcc ..., L1; j L2 且 L1 是下一个块 => b!cc ..., L2, 条件成立时落到下一个块
+inline bool RuleInvertBranch(Peephole &peephole, machine_block_t &block, size_t i)
+{
+    machine_inst_t &branch = block.insts[i];
+    size_t j = Peephole::Next(block, i);
+    if (branch.target < 0 || branch.op == MOP_J || j >= block.insts.size() || Peephole::Next(block, j) != block.insts.size())
+    {
+        return false;
+    }
+    machine_inst_t &jump = block.insts[j];
+    if (jump.op != MOP_J || branch.target != (int)peephole.BlockIndex() + 1)
+    {
+        return false;
+    }
+    branch.op = InvertBranch(branch.op);
+    branch.target = jump.target;
+    Peephole::Delete(jump);
+    return true;
+}
+
+static const peephole_rule_t peephole_rules[] = {
+    RuleRedundantMove,
+    RuleZeroOperand,
+    RuleStoreLoad,
+    RuleLoadZero,
+    RuleBranchOnSetZero,
+    RuleBranchOnXor,
+    RuleInvertBranch,
+    RuleJumpToNext};
+
+inline void RunPeephole(MachineFunction &mf)
+{
+    Peephole(mf).Run(peephole_rules, sizeof(peephole_rules) / sizeof(peephole_rules[0]));
+}
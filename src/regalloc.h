@@ -0,0 +1,1162 @@
+#pragma once
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cstdint>
+#include <set>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "cfg.h"
+#include "mir.h"
+
+using namespace std;
+
+// 参与寄存器分配的物理寄存器, caller-saved 在前: 不跨过函数调用的变量优先使用它们, 不需要保存恢复
+static const int alloc_order[] = {
+    REG_T0, REG_T1, REG_T2, REG_T3, REG_T4,
+    REG_A0, REG_A1, REG_A2, REG_A3, REG_A4, REG_A5, REG_A6, REG_A7,
+    REG_S0, REG_S1, REG_S2, REG_S3, REG_S4, REG_S5, REG_S6, REG_S7, REG_S8, REG_S9, REG_S10, REG_S11};
+
+inline bool IsAllocatable(int reg)
+{
+    return IsVirtualReg(reg) || (IsCallerSaved(reg) && reg != SCRATCH_REG1 && reg != SCRATCH_REG2) || IsCalleeSaved(reg);
+}
+
+class RegSet
+{
+private:
+    vector<uint64_t> words;
+public:
+    RegSet(size_t n = 0) : words((n + 63) / 64, 0)
+    {
+    }
+    bool Test(int i) const
+    {
+        return (words[i >> 6] >> (i & 63)) & 1;
+    }
+    void Set(int i)
+    {
+        words[i >> 6] |= (uint64_t)1 << (i & 63);
+    }
+    void Reset(int i)
+    {
+        words[i >> 6] &= ~((uint64_t)1 << (i & 63));
+    }
+    // this |= other, 返回是否有变化
+    bool UnionWith(const RegSet &other)
+    {
+        bool changed = false;
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            uint64_t merged = words[i] | other.words[i];
+            changed |= (merged != words[i]);
+            words[i] = merged;
+        }
+        return changed;
+    }
+    void IntersectWith(const RegSet &other)
+    {
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            words[i] &= other.words[i];
+        }
+    }
+    bool operator==(const RegSet &other) const
+    {
+        return words == other.words;
+    }
+    template <typename F>
+    void ForEach(F f) const
+    {
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            uint64_t word = words[i];
+            while (word != 0)
+            {
+                int bit = __builtin_ctzll(word);
+                f((int)(i * 64 + bit));
+                word &= word - 1;
+            }
+        }
+    }
+};
+
+// 以基本块为单位的活跃变量分析, 同时覆盖虚拟寄存器和参与分配的物理寄存器
+class Liveness
+{
+public:
+    vector<RegSet> live_in;
+    vector<RegSet> live_out;
+
+    void Compute(const MachineFunction &mf)
+    {
+        size_t reg_num = VREG_BASE + mf.vreg_count;
+        size_t block_num = mf.blocks.size();
+        vector<RegSet> gen(block_num, RegSet(reg_num));
+        vector<RegSet> kill(block_num, RegSet(reg_num));
+        live_in.assign(block_num, RegSet(reg_num));
+        live_out.assign(block_num, RegSet(reg_num));
+        vector<int> defs, uses;
+        for (size_t b = 0; b < block_num; b++)
+        {
+            for (const machine_inst_t &inst: mf.blocks[b].insts)
+            {
+                GetDefsUses(inst, defs, uses);
+                for (int reg: uses)
+                {
+                    if (IsAllocatable(reg) && !kill[b].Test(reg))
+                    {
+                        gen[b].Set(reg);
+                    }
+                }
+                for (int reg: defs)
+                {
+                    if (IsAllocatable(reg))
+                    {
+                        kill[b].Set(reg);
+                    }
+                }
+            }
+        }
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (size_t i = block_num; i-- > 0;)
+            {
+                for (int succ: mf.blocks[i].succs)
+                {
+                    live_out[i].UnionWith(live_in[succ]);
+                }
+                // live_in = gen | (live_out - kill)
+                RegSet in = gen[i];
+                live_out[i].ForEach([&](int reg)
+                {
+                    if (!kill[i].Test(reg))
+                    {
+                        in.Set(reg);
+                    }
+                });
+                changed |= live_in[i].UnionWith(in);
+            }
+        }
+    }
+};
+
+// 局部变量只通过栈帧对象上的 lw / sw 访问, 在寄存器分配之前把它们换成虚拟寄存器:
+// sw v, fi => mv r, v; lw d, fi => mv d, r. 用于叶函数, 使值都能放进 caller-saved 寄存器时
+// 函数完全不需要栈帧 (没有 ra, 溢出槽和 callee-saved 寄存器要保存).
+inline void PromoteFrameObjects(MachineFunction &mf)
+{
+    StackFrame &frame = mf.frame;
+    vector<int> promoted(frame.objects.size(), NO_REG);
+    for (size_t i = 0; i < frame.objects.size(); i++)
+    {
+        if (frame.objects[i].type == FrameObjectType::FO_LOCAL)
+        {
+            promoted[i] = mf.NewVReg();
+            frame.objects[i].type = FrameObjectType::FO_DEAD;
+        }
+    }
+    for (machine_block_t &block: mf.blocks)
+    {
+        for (machine_inst_t &inst: block.insts)
+        {
+            if (inst.frame_index < 0 || promoted[inst.frame_index] == NO_REG)
+            {
+                continue;
+            }
+            int reg = promoted[inst.frame_index];
+            if (inst.op == MOP_SW)
+            {
+                inst = MakeInst(MOP_MV, reg, inst.rs2);
+            }
+            else
+            {
+                assert(inst.op == MOP_LW);
+                inst = MakeInst(MOP_MV, inst.rd, reg);
+            }
+        }
+    }
+}
+
+// 分配结果: 每个虚拟寄存器对应的物理寄存器, 溢出到栈上的为 NO_REG
+typedef vector<int> reg_assignment_t;
+
+// 把虚拟寄存器替换为分配到的物理寄存器. 溢出的虚拟寄存器在每次使用前从栈上读到 t5 / t6,
+// 定值后立刻写回栈上. 同时删去源和目的相同的 mv, 记录用到的 callee-saved 寄存器.
+inline void RewriteRegisters(MachineFunction &mf, const reg_assignment_t &assignment)
+{
+    vector<int> spill_slots(mf.vreg_count, -1);
+    auto slot_of = [&](int vreg)
+    {
+        int &slot = spill_slots[vreg - VREG_BASE];
+        if (slot < 0)
+        {
+            slot = mf.frame.CreateObject(FrameObjectType::FO_SPILL);
+        }
+        return slot;
+    };
+    bool used[PHYS_REG_NUM] = {false};
+    for (machine_block_t &block: mf.blocks)
+    {
+        vector<machine_inst_t> insts;
+        insts.reserve(block.insts.size());
+        for (machine_inst_t inst: block.insts)
+        {
+            int reloaded[2] = {NO_REG, NO_REG};
+            int scratch[2] = {SCRATCH_REG1, SCRATCH_REG2};
+            int reload_count = 0;
+            for (int *reg: {&inst.rs1, &inst.rs2})
+            {
+                if (*reg == NO_REG || !IsVirtualReg(*reg))
+                {
+                    continue;
+                }
+                int phys = assignment[*reg - VREG_BASE];
+                if (phys != NO_REG)
+                {
+                    *reg = phys;
+                    continue;
+                }
+                int vreg = *reg;
+                if (reload_count > 0 && reloaded[0] == vreg)
+                {
+                    *reg = scratch[0];
+                    continue;
+                }
+                machine_inst_t load = MakeInst(MOP_LW, scratch[reload_count], REG_SP);
+                load.frame_index = slot_of(vreg);
+                insts.push_back(load);
+                reloaded[reload_count] = vreg;
+                *reg = scratch[reload_count++];
+            }
+            int spill_to = -1;
+            if (inst.rd != NO_REG && IsVirtualReg(inst.rd))
+            {
+                int phys = assignment[inst.rd - VREG_BASE];
+                if (phys != NO_REG)
+                {
+                    inst.rd = phys;
+                }
+                else
+                {
+                    spill_to = slot_of(inst.rd);
+                    inst.rd = SCRATCH_REG1;
+                }
+            }
+            if (inst.rd != NO_REG)
+            {
+                used[inst.rd] = true;
+            }
+            if (inst.op != MOP_MV || inst.rd != inst.rs1)
+            {
+                insts.push_back(inst);
+            }
+            if (spill_to >= 0)
+            {
+                machine_inst_t store = MakeInst(MOP_SW, NO_REG, REG_SP, SCRATCH_REG1);
+                store.frame_index = spill_to;
+                insts.push_back(store);
+            }
+        }
+        block.insts.swap(insts);
+    }
+    for (int reg: alloc_order)
+    {
+        if (used[reg] && IsCalleeSaved(reg))
+        {
+            mf.frame.saved_regs.push_back(reg);
+        }
+    }
+}
+
+typedef struct
+{
+    int vreg;
+    int start;
+    int end;
+} live_interval_t;
+
+// 线性扫描寄存器分配 (Poletto & Sarkar). 每个虚拟寄存器的活跃区间取为一整段 [start, end];
+// 物理寄存器 (参数, 返回值, 被 call 破坏的寄存器) 的活跃区间是精确的若干段,
+// 虚拟寄存器只能分到在其活跃区间内没有被占用的物理寄存器.
+// 第 i 条指令读操作数的位置是 2i, 写结果的位置是 2i + 1.
+class LinearScan
+{
+private:
+    MachineFunction &mf;
+    vector<live_interval_t> intervals;
+    vector<pair<int, int> > phys_ranges[PHYS_REG_NUM];
+    vector<int> hints;
+
+    void BuildIntervals()
+    {
+        mf.ComputeSuccs();
+        Liveness liveness;
+        liveness.Compute(mf);
+        intervals.resize(mf.vreg_count);
+        for (int i = 0; i < mf.vreg_count; i++)
+        {
+            intervals[i] = {VREG_BASE + i, INT_MAX, -1};
+        }
+        hints.assign(mf.vreg_count, NO_REG);
+        auto extend = [&](int reg, int pos)
+        {
+            live_interval_t &interval = intervals[reg - VREG_BASE];
+            interval.start = min(interval.start, pos);
+            interval.end = max(interval.end, pos);
+        };
+        vector<int> defs, uses;
+        int index = 0;
+        for (size_t b = 0; b < mf.blocks.size(); b++)
+        {
+            const machine_block_t &block = mf.blocks[b];
+            int block_start = 2 * index;
+            int block_end = 2 * (index + block.insts.size()) - 1;
+            liveness.live_in[b].ForEach([&](int reg)
+            {
+                if (IsVirtualReg(reg))
+                {
+                    extend(reg, block_start);
+                }
+            });
+            liveness.live_out[b].ForEach([&](int reg)
+            {
+                if (IsVirtualReg(reg))
+                {
+                    extend(reg, block_end);
+                }
+            });
+            // 反向扫描求物理寄存器的精确活跃段
+            int open_end[PHYS_REG_NUM];
+            for (int reg = 0; reg < PHYS_REG_NUM; reg++)
+            {
+                open_end[reg] = (IsAllocatable(reg) && liveness.live_out[b].Test(reg)) ? block_end : -1;
+            }
+            for (size_t k = block.insts.size(); k-- > 0;)
+            {
+                const machine_inst_t &inst = block.insts[k];
+                int pos = 2 * (index + k);
+                GetDefsUses(inst, defs, uses);
+                for (int reg: defs)
+                {
+                    if (IsVirtualReg(reg))
+                    {
+                        extend(reg, pos + 1);
+                    }
+                    else if (IsAllocatable(reg))
+                    {
+                        phys_ranges[reg].push_back({pos + 1, max(open_end[reg], pos + 1)});
+                        open_end[reg] = -1;
+                    }
+                }
+                for (int reg: uses)
+                {
+                    if (IsVirtualReg(reg))
+                    {
+                        extend(reg, pos);
+                    }
+                    else if (IsAllocatable(reg) && open_end[reg] < 0)
+                    {
+                        open_end[reg] = pos;
+                    }
+                }
+                if (inst.op == MOP_MV && IsAllocatable(inst.rd) && IsAllocatable(inst.rs1))
+                {
+                    // 目的寄存器优先使用源寄存器 (源是虚拟寄存器时为分配给它的物理寄存器), 参数寄存器反过来
+                    if (IsVirtualReg(inst.rd))
+                    {
+                        hints[inst.rd - VREG_BASE] = inst.rs1;
+                    }
+                    else if (IsVirtualReg(inst.rs1))
+                    {
+                        hints[inst.rs1 - VREG_BASE] = inst.rd;
+                    }
+                }
+            }
+            for (int reg = 0; reg < PHYS_REG_NUM; reg++)
+            {
+                if (open_end[reg] >= 0)
+                {
+                    phys_ranges[reg].push_back({block_start, open_end[reg]});
+                }
+            }
+            index += block.insts.size();
+        }
+        for (int reg = 0; reg < PHYS_REG_NUM; reg++)
+        {
+            sort(phys_ranges[reg].begin(), phys_ranges[reg].end());
+        }
+    }
+    bool PhysConflict(int reg, const live_interval_t &interval) const
+    {
+        const vector<pair<int, int> > &ranges = phys_ranges[reg];
+        auto it = lower_bound(ranges.begin(), ranges.end(), make_pair(interval.start, INT_MIN));
+        if (it != ranges.begin() && prev(it)->second >= interval.start)
+        {
+            return true;
+        }
+        return it != ranges.end() && it->first <= interval.end;
+    }
+public:
+    LinearScan(MachineFunction &mf) : mf(mf)
+    {
+    }
+    reg_assignment_t Run()
+    {
+        BuildIntervals();
+        reg_assignment_t assignment(mf.vreg_count, NO_REG);
+        vector<int> order;
+        for (int i = 0; i < mf.vreg_count; i++)
+        {
+            if (intervals[i].end >= 0)
+            {
+                order.push_back(i);
+            }
+        }
+        sort(order.begin(), order.end(), [&](int a, int b)
+        {
+            return intervals[a].start < intervals[b].start;
+        });
+        vector<int> active;
+        int owner[PHYS_REG_NUM];
+        fill(owner, owner + PHYS_REG_NUM, -1);
+        for (int cur: order)
+        {
+            const live_interval_t &interval = intervals[cur];
+            for (size_t i = 0; i < active.size();)
+            {
+                if (intervals[active[i]].end < interval.start)
+                {
+                    owner[assignment[active[i]]] = -1;
+                    active[i] = active.back();
+                    active.pop_back();
+                }
+                else
+                {
+                    i++;
+                }
+            }
+            int chosen = NO_REG;
+            int hint = hints[cur];
+            if (hint != NO_REG && IsVirtualReg(hint))
+            {
+                hint = assignment[hint - VREG_BASE];
+            }
+            if (hint != NO_REG && IsAllocatable(hint) && owner[hint] < 0 && !PhysConflict(hint, interval))
+            {
+                chosen = hint;
+            }
+            for (int k = 0; chosen == NO_REG && k < (int)(sizeof(alloc_order) / sizeof(alloc_order[0])); k++)
+            {
+                int reg = alloc_order[k];
+                if (owner[reg] < 0 && !PhysConflict(reg, interval))
+                {
+                    chosen = reg;
+                }
+            }
+            if (chosen == NO_REG)
+            {
+                // 没有空闲寄存器: 在可以换给当前区间的活跃区间中, 溢出结束得最晚的那个
+                int victim = -1;
+                for (size_t i = 0; i < active.size(); i++)
+                {
+                    int other = active[i];
+                    if (!PhysConflict(assignment[other], interval) && (victim < 0 || intervals[other].end > intervals[active[victim]].end))
+                    {
+                        victim = i;
+                    }
+                }
+                if (victim < 0 || intervals[active[victim]].end <= interval.end)
+                {
+                    continue;
+                }
+                int other = active[victim];
+                chosen = assignment[other];
+                assignment[other] = NO_REG;
+                active[victim] = active.back();
+                active.pop_back();
+            }
+            assignment[cur] = chosen;
+            owner[chosen] = cur;
+            active.push_back(cur);
+        }
+        return assignment;
+    }
+};
+
+// 每个基本块所在循环的嵌套深度: 用 cfg.h 的 ComputeIdom 求支配树, 后继支配前驱的边是回边.
+// 同一个循环头的所有回边 (例如 continue) 合并为一个自然循环, 循环中的块深度加一
+inline vector<int> ComputeLoopDepth(const MachineFunction &mf)
+{
+    size_t block_num = mf.blocks.size();
+    vector<vector<int> > succs(block_num), preds(block_num);
+    for (size_t b = 0; b < block_num; b++)
+    {
+        succs[b] = mf.blocks[b].succs;
+        for (int succ: mf.blocks[b].succs)
+        {
+            preds[succ].push_back(b);
+        }
+    }
+    vector<int> idom = ComputeIdom(succs, preds, 0);
+    auto dominates = [&](int header, int b)
+    {
+        if (idom[b] < 0)
+        {
+            return false;
+        }
+        while (b != header && b != idom[b])
+        {
+            b = idom[b];
+        }
+        return b == header;
+    };
+    vector<vector<int> > back_edges(block_num);
+    for (size_t b = 0; b < block_num; b++)
+    {
+        for (int header: succs[b])
+        {
+            if (dominates(header, b))
+            {
+                back_edges[header].push_back(b);
+            }
+        }
+    }
+    vector<int> depth(block_num, 0);
+    for (size_t header = 0; header < block_num; header++)
+    {
+        if (back_edges[header].empty())
+        {
+            continue;
+        }
+        vector<bool> in_loop(block_num, false);
+        vector<int> worklist = back_edges[header];
+        in_loop[header] = true;
+        while (!worklist.empty())
+        {
+            int cur = worklist.back();
+            worklist.pop_back();
+            if (in_loop[cur])
+            {
+                continue;
+            }
+            in_loop[cur] = true;
+            for (int pred: preds[cur])
+            {
+                worklist.push_back(pred);
+            }
+        }
+        for (size_t i = 0; i < block_num; i++)
+        {
+            depth[i] += in_loop[i];
+        }
+    }
+    return depth;
+}
+
+// 迭代寄存器合并 (George & Appel) 的图着色寄存器分配, 用于 -O2.
+// 物理寄存器作为预着色结点参与冲突图, 与参数/返回值寄存器之间的 mv 可以被合并掉.
+// 溢出代价为定值和使用次数按 10^循环深度 加权, 除以冲突图中的度数.
+// 实际溢出的结点不再重新构图, 直接由 RewriteRegisters 通过 t5 / t6 读写栈上的溢出槽.
+class GraphColoring
+{
+private:
+    enum NodeState{NS_NONE, NS_PRECOLORED, NS_SIMPLIFY, NS_FREEZE, NS_SPILL, NS_SELECT, NS_COALESCED, NS_COLORED, NS_SPILLED};
+    enum MoveState{MS_WORKLIST, MS_ACTIVE, MS_COALESCED, MS_CONSTRAINED, MS_FROZEN};
+
+    static const int K = sizeof(alloc_order) / sizeof(alloc_order[0]);
+
+    MachineFunction &mf;
+    int node_num;
+    vector<NodeState> state;
+    vector<int> degree;
+    vector<int> alias;
+    vector<int> color;
+    vector<double> spill_cost;
+    unordered_set<uint64_t> adj_set;
+    vector<vector<int> > adj_list;
+    vector<pair<int, int> > moves;
+    vector<MoveState> move_state;
+    vector<vector<int> > move_list;
+    vector<int> worklist_moves;
+    vector<int> simplify_worklist;
+    set<int> freeze_worklist;
+    set<int> spill_worklist;
+    vector<int> select_stack;
+
+    bool Precolored(int n) const
+    {
+        return state[n] == NS_PRECOLORED;
+    }
+    bool Adjacent(int u, int v) const
+    {
+        return adj_set.count((uint64_t)u * node_num + v) != 0;
+    }
+    void AddEdge(int u, int v)
+    {
+        if (u == v || Adjacent(u, v))
+        {
+            return;
+        }
+        adj_set.insert((uint64_t)u * node_num + v);
+        adj_set.insert((uint64_t)v * node_num + u);
+        if (!Precolored(u))
+        {
+            adj_list[u].push_back(v);
+            degree[u]++;
+        }
+        if (!Precolored(v))
+        {
+            adj_list[v].push_back(u);
+            degree[v]++;
+        }
+    }
+    template <typename F>
+    void ForEachAdjacent(int n, F f)
+    {
+        for (int m: adj_list[n])
+        {
+            if (state[m] != NS_SELECT && state[m] != NS_COALESCED)
+            {
+                f(m);
+            }
+        }
+    }
+    template <typename F>
+    void ForEachNodeMove(int n, F f)
+    {
+        for (int m: move_list[n])
+        {
+            if (move_state[m] == MS_ACTIVE || move_state[m] == MS_WORKLIST)
+            {
+                f(m);
+            }
+        }
+    }
+    bool MoveRelated(int n)
+    {
+        bool related = false;
+        ForEachNodeMove(n, [&](int)
+        {
+            related = true;
+        });
+        return related;
+    }
+    void Build()
+    {
+        mf.ComputeSuccs();
+        Liveness liveness;
+        liveness.Compute(mf);
+        vector<int> loop_depth = ComputeLoopDepth(mf);
+        for (int reg = 0; reg < PHYS_REG_NUM; reg++)
+        {
+            if (IsAllocatable(reg))
+            {
+                state[reg] = NS_PRECOLORED;
+                color[reg] = reg;
+                degree[reg] = INT_MAX / 2;
+            }
+        }
+        vector<bool> appeared(node_num, false);
+        vector<int> defs, uses;
+        for (size_t b = 0; b < mf.blocks.size(); b++)
+        {
+            const machine_block_t &block = mf.blocks[b];
+            double weight = 1;
+            for (int i = 0; i < min(loop_depth[b], 8); i++)
+            {
+                weight *= 10;
+            }
+            RegSet live = liveness.live_out[b];
+            for (size_t k = block.insts.size(); k-- > 0;)
+            {
+                const machine_inst_t &inst = block.insts[k];
+                GetDefsUses(inst, defs, uses);
+                auto allocatable = [](int reg)
+                {
+                    return !IsAllocatable(reg);
+                };
+                defs.erase(remove_if(defs.begin(), defs.end(), allocatable), defs.end());
+                uses.erase(remove_if(uses.begin(), uses.end(), allocatable), uses.end());
+                for (int reg: defs)
+                {
+                    appeared[reg] = true;
+                    spill_cost[reg] += weight;
+                }
+                for (int reg: uses)
+                {
+                    appeared[reg] = true;
+                    spill_cost[reg] += weight;
+                }
+                if (inst.op == MOP_MV && defs.size() == 1 && uses.size() == 1)
+                {
+                    live.Reset(uses[0]);
+                    int move = moves.size();
+                    moves.push_back({defs[0], uses[0]});
+                    move_state.push_back(MS_WORKLIST);
+                    move_list[defs[0]].push_back(move);
+                    move_list[uses[0]].push_back(move);
+                    worklist_moves.push_back(move);
+                }
+                for (int reg: defs)
+                {
+                    live.Set(reg);
+                }
+                for (int reg: defs)
+                {
+                    live.ForEach([&](int other)
+                    {
+                        AddEdge(other, reg);
+                    });
+                }
+                for (int reg: defs)
+                {
+                    live.Reset(reg);
+                }
+                for (int reg: uses)
+                {
+                    live.Set(reg);
+                }
+            }
+        }
+        for (int n = VREG_BASE; n < node_num; n++)
+        {
+            if (!appeared[n])
+            {
+                continue;
+            }
+            if (degree[n] >= K)
+            {
+                state[n] = NS_SPILL;
+                spill_worklist.insert(n);
+            }
+            else if (MoveRelated(n))
+            {
+                state[n] = NS_FREEZE;
+                freeze_worklist.insert(n);
+            }
+            else
+            {
+                state[n] = NS_SIMPLIFY;
+                simplify_worklist.push_back(n);
+            }
+        }
+    }
+    void EnableMoves(int n)
+    {
+        ForEachNodeMove(n, [&](int m)
+        {
+            if (move_state[m] == MS_ACTIVE)
+            {
+                move_state[m] = MS_WORKLIST;
+                worklist_moves.push_back(m);
+            }
+        });
+    }
+    void DecrementDegree(int m)
+    {
+        if (Precolored(m))
+        {
+            return;
+        }
+        int d = degree[m]--;
+        if (d == K)
+        {
+            EnableMoves(m);
+            ForEachAdjacent(m, [&](int n)
+            {
+                EnableMoves(n);
+            });
+            spill_worklist.erase(m);
+            if (MoveRelated(m))
+            {
+                state[m] = NS_FREEZE;
+                freeze_worklist.insert(m);
+            }
+            else
+            {
+                state[m] = NS_SIMPLIFY;
+                simplify_worklist.push_back(m);
+            }
+        }
+    }
+    void Simplify()
+    {
+        int n = simplify_worklist.back();
+        simplify_worklist.pop_back();
+        state[n] = NS_SELECT;
+        select_stack.push_back(n);
+        for (int m: adj_list[n])
+        {
+            if (state[m] != NS_SELECT && state[m] != NS_COALESCED)
+            {
+                DecrementDegree(m);
+            }
+        }
+    }
+    int GetAlias(int n) const
+    {
+        while (state[n] == NS_COALESCED)
+        {
+            n = alias[n];
+        }
+        return n;
+    }
+    void AddWorkList(int u)
+    {
+        if (!Precolored(u) && !MoveRelated(u) && degree[u] < K)
+        {
+            freeze_worklist.erase(u);
+            state[u] = NS_SIMPLIFY;
+            simplify_worklist.push_back(u);
+        }
+    }
+    // George: v 的每个邻居要么度数小, 要么是预着色结点, 要么已经与 u 冲突
+    bool GeorgeTest(int u, int v)
+    {
+        bool ok = true;
+        ForEachAdjacent(v, [&](int t)
+        {
+            ok &= degree[t] < K || Precolored(t) || Adjacent(t, u);
+        });
+        return ok;
+    }
+    // Briggs: 合并后的结点中度数不小于 K 的邻居少于 K 个
+    bool BriggsTest(int u, int v)
+    {
+        unordered_set<int> neighbors;
+        ForEachAdjacent(u, [&](int t)
+        {
+            neighbors.insert(t);
+        });
+        ForEachAdjacent(v, [&](int t)
+        {
+            neighbors.insert(t);
+        });
+        int k = 0;
+        for (int t: neighbors)
+        {
+            k += degree[t] >= K;
+        }
+        return k < K;
+    }
+    void Combine(int u, int v)
+    {
+        if (state[v] == NS_FREEZE)
+        {
+            freeze_worklist.erase(v);
+        }
+        else
+        {
+            spill_worklist.erase(v);
+        }
+        state[v] = NS_COALESCED;
+        alias[v] = u;
+        move_list[u].insert(move_list[u].end(), move_list[v].begin(), move_list[v].end());
+        spill_cost[u] += spill_cost[v];
+        EnableMoves(v);
+        vector<int> neighbors;
+        ForEachAdjacent(v, [&](int t)
+        {
+            neighbors.push_back(t);
+        });
+        for (int t: neighbors)
+        {
+            AddEdge(t, u);
+            DecrementDegree(t);
+        }
+        if (degree[u] >= K && state[u] == NS_FREEZE)
+        {
+            freeze_worklist.erase(u);
+            state[u] = NS_SPILL;
+            spill_worklist.insert(u);
+        }
+    }
+    void Coalesce()
+    {
+        int m = worklist_moves.back();
+        worklist_moves.pop_back();
+        if (move_state[m] != MS_WORKLIST)
+        {
+            return;
+        }
+        int x = GetAlias(moves[m].first);
+        int y = GetAlias(moves[m].second);
+        int u = x, v = y;
+        if (Precolored(y))
+        {
+            u = y;
+            v = x;
+        }
+        if (u == v)
+        {
+            move_state[m] = MS_COALESCED;
+            AddWorkList(u);
+        }
+        else if (Precolored(v) || Adjacent(u, v))
+        {
+            move_state[m] = MS_CONSTRAINED;
+            AddWorkList(u);
+            AddWorkList(v);
+        }
+        else if (Precolored(u) ? GeorgeTest(u, v) : BriggsTest(u, v))
+        {
+            move_state[m] = MS_COALESCED;
+            Combine(u, v);
+            AddWorkList(u);
+        }
+        else
+        {
+            move_state[m] = MS_ACTIVE;
+        }
+    }
+    void FreezeMoves(int u)
+    {
+        vector<int> node_moves;
+        ForEachNodeMove(u, [&](int m)
+        {
+            node_moves.push_back(m);
+        });
+        for (int m: node_moves)
+        {
+            int x = moves[m].first, y = moves[m].second;
+            int v = (GetAlias(y) == GetAlias(u)) ? GetAlias(x) : GetAlias(y);
+            move_state[m] = MS_FROZEN;
+            if (state[v] == NS_FREEZE && !MoveRelated(v) && degree[v] < K)
+            {
+                freeze_worklist.erase(v);
+                state[v] = NS_SIMPLIFY;
+                simplify_worklist.push_back(v);
+            }
+        }
+    }
+    void Freeze()
+    {
+        int u = *freeze_worklist.begin();
+        freeze_worklist.erase(freeze_worklist.begin());
+        state[u] = NS_SIMPLIFY;
+        simplify_worklist.push_back(u);
+        FreezeMoves(u);
+    }
+    void SelectSpill()
+    {
+        int best = -1;
+        for (int n: spill_worklist)
+        {
+            if (best < 0 || spill_cost[n] * degree[best] < spill_cost[best] * degree[n])
+            {
+                best = n;
+            }
+        }
+        spill_worklist.erase(best);
+        state[best] = NS_SIMPLIFY;
+        simplify_worklist.push_back(best);
+        FreezeMoves(best);
+    }
+    void AssignColors()
+    {
+        while (!select_stack.empty())
+        {
+            int n = select_stack.back();
+            select_stack.pop_back();
+            bool forbidden[PHYS_REG_NUM] = {false};
+            for (int w: adj_list[n])
+            {
+                int a = GetAlias(w);
+                if (state[a] == NS_COLORED || state[a] == NS_PRECOLORED)
+                {
+                    forbidden[color[a]] = true;
+                }
+            }
+            state[n] = NS_SPILLED;
+            for (int reg: alloc_order)
+            {
+                if (!forbidden[reg])
+                {
+                    state[n] = NS_COLORED;
+                    color[n] = reg;
+                    break;
+                }
+            }
+        }
+    }
+public:
+    GraphColoring(MachineFunction &mf) : mf(mf)
+    {
+        node_num = VREG_BASE + mf.vreg_count;
+        state.assign(node_num, NS_NONE);
+        degree.assign(node_num, 0);
+        alias.assign(node_num, -1);
+        color.assign(node_num, NO_REG);
+        spill_cost.assign(node_num, 0);
+        adj_list.resize(node_num);
+        move_list.resize(node_num);
+    }
+    reg_assignment_t Run()
+    {
+        Build();
+        while (!simplify_worklist.empty() || !worklist_moves.empty() || !freeze_worklist.empty() || !spill_worklist.empty())
+        {
+            if (!simplify_worklist.empty())
+            {
+                Simplify();
+            }
+            else if (!worklist_moves.empty())
+            {
+                Coalesce();
+            }
+            else if (!freeze_worklist.empty())
+            {
+                Freeze();
+            }
+            else
+            {
+                SelectSpill();
+            }
+        }
+        AssignColors();
+        reg_assignment_t assignment(mf.vreg_count, NO_REG);
+        for (int n = VREG_BASE; n < node_num; n++)
+        {
+            int a = GetAlias(n);
+            if (state[a] == NS_COLORED || state[a] == NS_PRECOLORED)
+            {
+                assignment[n - VREG_BASE] = color[a];
+            }
+        }
+        return assignment;
+    }
+};
+
+// 栈槽着色: 把局部变量和溢出槽看作以 sw 定值, 以 lw 使用的变量求活跃信息,
+// 活跃范围不重叠的对象共用同一个栈槽, 从而缩小栈帧. 通过栈传入的参数不参与合并.
+inline void ColorStackSlots(MachineFunction &mf)
+{
+    StackFrame &frame = mf.frame;
+    size_t object_num = frame.objects.size();
+    size_t block_num = mf.blocks.size();
+    if (object_num == 0)
+    {
+        return;
+    }
+    mf.ComputeSuccs();
+    vector<RegSet> gen(block_num, RegSet(object_num));
+    vector<RegSet> kill(block_num, RegSet(object_num));
+    for (size_t b = 0; b < block_num; b++)
+    {
+        for (const machine_inst_t &inst: mf.blocks[b].insts)
+        {
+            if (inst.op == MOP_LW && inst.frame_index >= 0 && !kill[b].Test(inst.frame_index))
+            {
+                gen[b].Set(inst.frame_index);
+            }
+            else if (inst.op == MOP_SW && inst.frame_index >= 0)
+            {
+                kill[b].Set(inst.frame_index);
+            }
+        }
+    }
+    vector<RegSet> live_in(block_num, RegSet(object_num));
+    vector<RegSet> live_out(block_num, RegSet(object_num));
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (size_t i = block_num; i-- > 0;)
+        {
+            for (int succ: mf.blocks[i].succs)
+            {
+                live_out[i].UnionWith(live_in[succ]);
+            }
+            RegSet in = gen[i];
+            live_out[i].ForEach([&](int object)
+            {
+                if (!kill[i].Test(object))
+                {
+                    in.Set(object);
+                }
+            });
+            changed |= live_in[i].UnionWith(in);
+        }
+    }
+    // 写入一个对象时, 所有活跃的对象都与它冲突
+    vector<vector<int> > adj(object_num);
+    unordered_set<uint64_t> edges;
+    for (size_t b = 0; b < block_num; b++)
+    {
+        RegSet live = live_out[b];
+        const vector<machine_inst_t> &insts = mf.blocks[b].insts;
+        for (size_t k = insts.size(); k-- > 0;)
+        {
+            const machine_inst_t &inst = insts[k];
+            if (inst.frame_index < 0)
+            {
+                continue;
+            }
+            int fi = inst.frame_index;
+            if (inst.op == MOP_SW)
+            {
+                live.ForEach([&](int other)
+                {
+                    if (other != fi && edges.insert((uint64_t)min(fi, other) * object_num + max(fi, other)).second)
+                    {
+                        adj[fi].push_back(other);
+                        adj[other].push_back(fi);
+                    }
+                });
+                live.Reset(fi);
+            }
+            else
+            {
+                live.Set(fi);
+            }
+        }
+    }
+    // 贪心着色, 每种颜色对应新栈帧中的一个对象
+    vector<int> new_index(object_num, -1);
+    vector<frame_object_t> objects;
+    for (size_t i = 0; i < object_num; i++)
+    {
+        if (frame.objects[i].type == FrameObjectType::FO_INCOMING || frame.objects[i].type == FrameObjectType::FO_DEAD)
+        {
+            new_index[i] = objects.size();
+            objects.push_back(frame.objects[i]);
+            continue;
+        }
+        vector<bool> taken(objects.size(), false);
+        for (int other: adj[i])
+        {
+            if (new_index[other] >= 0)
+            {
+                taken[new_index[other]] = true;
+            }
+        }
+        for (size_t slot = 0; slot < objects.size(); slot++)
+        {
+            if (!taken[slot] && (objects[slot].type == FrameObjectType::FO_LOCAL || objects[slot].type == FrameObjectType::FO_SPILL))
+            {
+                new_index[i] = slot;
+                break;
+            }
+        }
+        if (new_index[i] < 0)
+        {
+            new_index[i] = objects.size();
+            objects.push_back(frame.objects[i]);
+        }
+    }
+    for (machine_block_t &block: mf.blocks)
+    {
+        for (machine_inst_t &inst: block.insts)
+        {
+            if (inst.frame_index >= 0)
+            {
+                inst.frame_index = new_index[inst.frame_index];
+            }
+        }
+    }
+    frame.objects.swap(objects);
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <iostream>
@@ -6,110 +7,18 @@
 #include <string>
 #include <string.h>
 #include <sstream>
-#include <map>
 #include <unordered_map>
+#include "context.h"
+#include "layout.h"
+#include "mir.h"
+#include "peephole.h"
+#include "regalloc.h"
+#include "schedule.h"
+#include "thread_pool.h"
 #include "koopa.h"
-#define REG_NUM 15
-#define MAX_IMMEDIATE_VAL 2048
-#define ZERO_REG_ID 15
-#define PARAM_REG_NUM 8
 
 using namespace std;
 
-class StackFrame
-{
-public:
-    StackFrame()
-    {
-        top = 0;
-    }
-    void set_stack_size(int size, bool store_ra_, int max_args_num_)
-    {
-        assert(size % 16 == 0);
-        assert(size >= 0);
-        stack_size = size;
-        top = (max_args_num_ - 8) * 4;
-        if (top < 0)
-        {
-            top = 0;
-        }
-        store_ra = store_ra_;
-    }
-    int push()
-    {
-        top += 4;
-        assert(top <= stack_size);
-        return top - 4;
-    }
-    int get_stack_size() const
-    {
-        return stack_size;
-    }
-    bool is_store_ra() const
-    {
-        return store_ra;
-    }
-private:
-    int stack_size;
-    int top;
-    bool store_ra;
-} stack_frame;
-
-class RegManager
-{
-private:
-    unordered_map<int, bool> regs_occupied;
-public:
-    RegManager()
-    {
-        for (int i = 0; i < REG_NUM; i++)
-        {
-            regs_occupied[i] = false;
-        }
-    }
-    void free_regs()
-    {
-        for (int i = 0; i < REG_NUM; i++)
-        {
-            regs_occupied[i] = false;
-        }
-    }
-    int alloc_reg()
-    {
-        int ret = -1;
-        for (int i = 0; i < REG_NUM; i++)
-        {
-            if (regs_occupied[i] == false)
-            {
-                ret = i;
-                regs_occupied[i] = true;
-                break;
-            }
-        }
-        assert(ret != -1);
-        return ret;
-    }
-    int alloc_reg(int i)
-    {
-        assert(regs_occupied[i] == false);
-        regs_occupied[i] = true;
-        return i;
-    }
-    void free(int i)
-    {
-        regs_occupied[i] = false;
-    }
-} reg_manager;
-
-enum VAR_TYPE{ON_STACK, ON_REG, ON_GLOBAL};
-
-typedef struct{
-    VAR_TYPE type;
-    int stack_location;
-    int reg_id;
-    string global_name;
-} var_info_t;
-
 void Visit(const koopa_raw_program_t &program);
 void Visit(const koopa_raw_slice_t &slice);
 void Visit(const koopa_raw_function_t &func);
@@ -118,27 +27,73 @@ void Visit(const koopa_raw_return_t &ret);
 void Visit(const koopa_raw_store_t &store);
 void Visit(const koopa_raw_branch_t &branch);
 void Visit(const koopa_raw_jump_t &jump);
-void Prologue(const koopa_raw_function_t &func);
-void Epilogue();
+void LowerParams(const koopa_raw_function_t &func);
+void LowerBlockParams(const koopa_raw_function_t &func);
+void EmitBlockArgs(const koopa_raw_basic_block_t &target, const koopa_raw_slice_t &args);
+int EdgeTarget(const koopa_raw_basic_block_t &target, const koopa_raw_slice_t &args, const char *suffix);
+void FindBranchConds(const koopa_raw_function_t &func);
+void FindTailCalls(const koopa_raw_function_t &func);
+void LowerFrame(MachineFunction &mf);
 var_info_t Visit(const koopa_raw_value_t &value);
 var_info_t Visit(const koopa_raw_integer_t &interger);
 var_info_t Visit(const koopa_raw_binary_t &binary);
+bool SelectImmBinary(koopa_raw_binary_op_t op, int new_reg, int l_reg, int32_t imm);
+bool SelectMulConst(int new_reg, int l_reg, int32_t imm);
+bool SelectDivConst(int new_reg, int l_reg, int32_t imm, bool is_rem);
 var_info_t Visit(const koopa_raw_load_t &load);
-var_info_t Visit(const koopa_raw_call_t &call, bool is_ret);
+var_info_t Visit(const koopa_raw_call_t &call, bool is_ret, bool is_tail);
 var_info_t Visit(const koopa_raw_global_alloc_t &global_alloc);
-string gen_reg(int id);
-void GenLoadStoreInst(string op, string reg1, int imm, string reg2);
+bool FindVar(const koopa_raw_value_t &value, var_info_t &info);
+void SetVar(const koopa_raw_value_t &value, const var_info_t &info);
+int LocalIndex(const koopa_raw_value_t &value);
+int GetBlockId(const koopa_raw_basic_block_t &bb);
+int GlobalBase(int global_id);
+void Emit(const machine_inst_t &inst);
+void GenLoadStoreInst(vector<machine_inst_t> &insts, MachineOp op, int reg, int imm, int scratch);
 
-static const string regs[REG_NUM + 1] = {"t0", "t1", "t2", "t3", "t4", "t5", "t6", "a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "x0"};
-static map<koopa_raw_value_t, var_info_t> is_visited;
-static map<koopa_raw_binary_op_t, string> op_names = {{KOOPA_RBO_GT, "sgt"}, {KOOPA_RBO_LT, "slt"}, {KOOPA_RBO_ADD, "add"}, {KOOPA_RBO_SUB, "sub"}, {KOOPA_RBO_MUL, "mul"}, {KOOPA_RBO_DIV, "div"}, {KOOPA_RBO_MOD, "rem"}, {KOOPA_RBO_AND, "and"}, {KOOPA_RBO_OR, "or"}};
-static int global_count = 0;
+// 以 koopa_raw_binary_op_t 为下标: 交换左右操作数后对应的运算, 不能交换时为 -1
+static const int swapped_ops[] = {
+    // ne eq gt lt ge le
+    KOOPA_RBO_NOT_EQ, KOOPA_RBO_EQ, KOOPA_RBO_LT, KOOPA_RBO_GT, KOOPA_RBO_LE, KOOPA_RBO_GE,
+    // add sub mul div mod and or
+    KOOPA_RBO_ADD, -1, KOOPA_RBO_MUL, -1, -1, KOOPA_RBO_AND, KOOPA_RBO_OR,
+    // xor shl shr sar
+    -1, -1, -1, -1};
+// 以 koopa_raw_binary_op_t 为下标: 可以用一条 R 型指令完成的运算对应的指令, 其余为 MOP_NOP
+static const MachineOp op_names[] = {
+    // ne eq gt lt ge le
+    MOP_NOP, MOP_NOP, MOP_SGT, MOP_SLT, MOP_NOP, MOP_NOP,
+    // add sub mul div mod and or
+    MOP_ADD, MOP_SUB, MOP_MUL, MOP_DIV, MOP_REM, MOP_AND, MOP_OR,
+    // xor shl shr sar
+    MOP_NOP, MOP_NOP, MOP_NOP, MOP_NOP};
 
 void Visit(const koopa_raw_program_t &program)
 {
-    Visit(program.values);
-    cout << "  .text" << endl;
-    Visit(program.funcs);
+    for (uint32_t i = 0; i < program.values.len; i++)
+    {
+        koopa_raw_value_t value = reinterpret_cast<koopa_raw_value_t>(program.values.buffer[i]);
+        assert(value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC);
+        ctx->global_vars.push_back(Visit(value->kind.data.global_alloc));
+    }
+    ctx->emitter << "  .text\n";
+    // 每个函数在线程池上生成到自己的缓冲区, 再按函数原本的顺序拼接, 输出与串行生成完全相同
+    vector<string> texts(program.funcs.len);
+    CompilationContext *context = ctx;
+    ThreadPool pool(ctx->codegen_jobs);
+    pool.Run(program.funcs.len, [&](size_t i)
+    {
+        ctx = context;
+        FunctionContext func_ctx;
+        fctx = &func_ctx;
+        Visit(reinterpret_cast<koopa_raw_function_t>(program.funcs.buffer[i]));
+        texts[i] = func_ctx.emitter.TakeText();
+        fctx = nullptr;
+    });
+    for (const string &text: texts)
+    {
+        ctx->emitter << text;
+    }
 }
 
 void Visit(const koopa_raw_slice_t &slice)
@@ -163,228 +118,505 @@ void Visit(const koopa_raw_slice_t &slice)
     }
 }
 
+// 先把函数翻译成使用虚拟寄存器的机器指令, 调整基本块顺序后做寄存器分配和栈槽合并, 确定栈帧布局并插入序言和尾声,
+// 最后做窥孔优化和指令调度. -O2 时在寄存器分配之前还会调度一次
 void Visit(const koopa_raw_function_t &func)
 {
     if (func->bbs.len == 0)
     {
         return;
     }
-    string func_name = string(func->name + 1);
-    cout << "  .globl " << func_name << endl;
-    cout << func_name << ":" << endl;
-    Prologue(func);
+    MachineFunction &mf = fctx->mf;
+    mf.name = func->name + 1;
+    fctx->Init(ValueNum(func), ctx->global_vars.size());
+    for (uint32_t i = 0; i < func->bbs.len; i++)
+    {
+        mf.NewBlock(reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i])->name + 1);
+    }
+    fctx->cur_block = 0;
+    FindBranchConds(func);
+    if (ctx->opt_level >= 1)
+    {
+        FindTailCalls(func);
+    }
+    LowerParams(func);
+    LowerBlockParams(func);
     Visit(func->bbs);
-    cout << endl;
+    if (ctx->opt_level >= 1 && mf.IsLeaf())
+    {
+        PromoteFrameObjects(mf);
+    }
+    if (ctx->opt_level >= 1)
+    {
+        LayoutBlocks(mf);
+    }
+    if (ctx->opt_level >= 2)
+    {
+        ScheduleBlocks(mf, PRE_RA_SCHED_WINDOW);
+    }
+    reg_assignment_t assignment = (ctx->opt_level >= 2) ? GraphColoring(mf).Run() : LinearScan(mf).Run();
+    RewriteRegisters(mf, assignment);
+    if (ctx->opt_level >= 1)
+    {
+        ColorStackSlots(mf);
+    }
+    LowerFrame(mf);
+    if (ctx->opt_level >= 1)
+    {
+        RunPeephole(mf);
+        ScheduleBlocks(mf);
+    }
+    MachinePrinter(fctx->emitter).Print(mf);
 }
 
 void Visit(const koopa_raw_basic_block_t &bb)
 {
-    cout << bb->name + 1 << ":" << endl;
+    fctx->cur_block = GetBlockId(bb);
     Visit(bb->insts);
 }
 
 void Visit(const koopa_raw_return_t &ret)
 {
     koopa_raw_value_t value = ret.value;
-    cout << endl << "  # ret" << endl;
+    machine_inst_t inst = MakeInst(MOP_RET);
     if (value)
     {
         var_info_t var = Visit(value);
         assert(var.type == VAR_TYPE::ON_REG);
-        cout << "  mv a0, " << gen_reg(var.reg_id) << endl;
+        Emit(MakeInst(MOP_MV, REG_A0, var.reg_id));
+        inst.imm = 1;
     }
-    Epilogue();
-    cout << "  ret" << endl;
+    Emit(inst);
 }
 
 void Visit(const koopa_raw_store_t &store)
 {
-    cout << endl << "  # store" << endl;
     koopa_raw_value_t dst = store.dest;
-    assert(is_visited.find(dst) != is_visited.end());
+    var_info_t dst_var;
+    bool found = FindVar(dst, dst_var);
+    assert(found);
     var_info_t src_var = Visit(store.value);
     assert(src_var.type == VAR_TYPE::ON_REG);
-    var_info_t dst_var = is_visited[dst];
-    if(dst->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
+    if (dst_var.type == VAR_TYPE::ON_GLOBAL)
     {
-        int reg_id = reg_manager.alloc_reg();
-        cout << "  la " << gen_reg(reg_id) << ", " << dst_var.global_name << endl;
-        cout << "  sw " << gen_reg(src_var.reg_id) << ", 0(" << gen_reg(reg_id) << ")" << endl;
+        machine_inst_t inst = MakeInst(MOP_SW, NO_REG, GlobalBase(dst_var.global_id), src_var.reg_id);
+        inst.global_id = dst_var.global_id;
+        Emit(inst);
     }
     else
     {
-        GenLoadStoreInst("sw", gen_reg(src_var.reg_id), dst_var.stack_location, "sp");
+        machine_inst_t inst = MakeInst(MOP_SW, NO_REG, REG_SP, src_var.reg_id);
+        inst.frame_index = dst_var.frame_index;
+        Emit(inst);
     }
 }
 
 void Visit(const koopa_raw_branch_t &branch)
 {
-    cout << endl << "  # branch" << endl;
-    string label_true = branch.true_bb->name + 1;
-    string label_false = branch.false_bb->name + 1;
-    var_info_t var = Visit(branch.cond);
-    reg_manager.free_regs();
-    string var_name;
-    if (var.type == VAR_TYPE::ON_REG)
+    koopa_raw_value_t cond = branch.cond;
+    if (cond->kind.tag == KOOPA_RVT_BINARY && fctx->branch_conds[LocalIndex(cond)])
     {
-        var_name = gen_reg(var.reg_id);
-    }
-    else
-    {
-        var_name = to_string(var.stack_location) + "(sp)";
+        // 比较运算直接生成条件跳转: a > b 即 b < a, a <= b 即 b >= a
+        const koopa_raw_binary_t &binary = cond->kind.data.binary;
+        var_info_t lvar = Visit(binary.lhs);
+        var_info_t rvar = Visit(binary.rhs);
+        assert(lvar.type == VAR_TYPE::ON_REG && rvar.type == VAR_TYPE::ON_REG);
+        machine_inst_t inst;
+        switch (binary.op)
+        {
+        case KOOPA_RBO_EQ:
+            inst = MakeInst(MOP_BEQ, NO_REG, lvar.reg_id, rvar.reg_id);
+            break;
+        case KOOPA_RBO_NOT_EQ:
+            inst = MakeInst(MOP_BNE, NO_REG, lvar.reg_id, rvar.reg_id);
+            break;
+        case KOOPA_RBO_LT:
+            inst = MakeInst(MOP_BLT, NO_REG, lvar.reg_id, rvar.reg_id);
+            break;
+        case KOOPA_RBO_GT:
+            inst = MakeInst(MOP_BLT, NO_REG, rvar.reg_id, lvar.reg_id);
+            break;
+        case KOOPA_RBO_LE:
+            inst = MakeInst(MOP_BGE, NO_REG, rvar.reg_id, lvar.reg_id);
+            break;
+        case KOOPA_RBO_GE:
+            inst = MakeInst(MOP_BGE, NO_REG, lvar.reg_id, rvar.reg_id);
+            break;
+        default:
+            assert(false);
+        }
+        inst.target = EdgeTarget(branch.true_bb, branch.true_args, "_t");
+        Emit(inst);
+        machine_inst_t j = MakeInst(MOP_J);
+        j.target = EdgeTarget(branch.false_bb, branch.false_args, "_f");
+        Emit(j);
+        return;
     }
-    cout << "  bnez  " << var_name << ", " << label_true << endl;
-    cout << "  j     " << label_false << endl;
+    var_info_t var = Visit(cond);
+    assert(var.type == VAR_TYPE::ON_REG);
+    machine_inst_t bnez = MakeInst(MOP_BNEZ, NO_REG, var.reg_id);
+    bnez.target = EdgeTarget(branch.true_bb, branch.true_args, "_t");
+    Emit(bnez);
+    machine_inst_t j = MakeInst(MOP_J);
+    j.target = EdgeTarget(branch.false_bb, branch.false_args, "_f");
+    Emit(j);
 }
 
 void Visit(const koopa_raw_jump_t &jump)
 {
-    cout << endl << "  # jump" << endl;
-    string label_target = jump.target->name + 1;
-    cout << "  j     " << label_target << endl;
-    reg_manager.free_regs();
+    EmitBlockArgs(jump.target, jump.args);
+    machine_inst_t j = MakeInst(MOP_J);
+    j.target = GetBlockId(jump.target);
+    Emit(j);
 }
 
-void Prologue(const koopa_raw_function_t &func)
+// 对 Koopa 指令的每个操作数调用 f
+template <typename F>
+void ForEachOperand(koopa_raw_value_t inst, F f)
 {
-    cout << endl << "  # prologue" << endl;
-    int stack_size = 0;
-    bool store_ra = false;
-    int max_args_num = 0;
+    const auto &kind = inst->kind;
+    switch (kind.tag)
+    {
+    case KOOPA_RVT_BINARY:
+        f(kind.data.binary.lhs);
+        f(kind.data.binary.rhs);
+        break;
+    case KOOPA_RVT_LOAD:
+        f(kind.data.load.src);
+        break;
+    case KOOPA_RVT_STORE:
+        f(kind.data.store.value);
+        f(kind.data.store.dest);
+        break;
+    case KOOPA_RVT_BRANCH:
+        f(kind.data.branch.cond);
+        for (uint32_t i = 0; i < kind.data.branch.true_args.len; i++)
+        {
+            f(reinterpret_cast<koopa_raw_value_t>(kind.data.branch.true_args.buffer[i]));
+        }
+        for (uint32_t i = 0; i < kind.data.branch.false_args.len; i++)
+        {
+            f(reinterpret_cast<koopa_raw_value_t>(kind.data.branch.false_args.buffer[i]));
+        }
+        break;
+    case KOOPA_RVT_JUMP:
+        for (uint32_t i = 0; i < kind.data.jump.args.len; i++)
+        {
+            f(reinterpret_cast<koopa_raw_value_t>(kind.data.jump.args.buffer[i]));
+        }
+        break;
+    case KOOPA_RVT_RETURN:
+        if (kind.data.ret.value)
+        {
+            f(kind.data.ret.value);
+        }
+        break;
+    case KOOPA_RVT_CALL:
+        for (uint32_t i = 0; i < kind.data.call.args.len; i++)
+        {
+            f(reinterpret_cast<koopa_raw_value_t>(kind.data.call.args.buffer[i]));
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+// 找出只被同一个块末尾的 branch 使用的比较运算
+void FindBranchConds(const koopa_raw_function_t &func)
+{
+    vector<int> use_count(ValueNum(func), 0);
     for (uint32_t i = 0; i < func->bbs.len; i++)
     {
         koopa_raw_basic_block_t bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
-        for (uint32_t j = 0; j < bb->insts.len; ++j)
+        for (uint32_t j = 0; j < bb->insts.len; j++)
         {
-            koopa_raw_value_t inst = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]);
-            if (inst->ty->tag != KOOPA_RTT_UNIT)
+            ForEachOperand(reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[j]), [&](koopa_raw_value_t operand)
             {
-                stack_size = stack_size + 4;
-            }
-            if (inst->kind.tag == KOOPA_RVT_CALL)
-            {
-                store_ra = true;
-                int args_num = inst->kind.data.call.args.len;
-                if (args_num > max_args_num)
+                int index = LocalIndex(operand);
+                if (index >= 0)
                 {
-                    max_args_num = args_num;
+                    use_count[index]++;
                 }
-            }
+            });
         }
     }
-    if (store_ra)
-    {
-        stack_size += 4;
-    }
-    if (max_args_num > 8)
-    {
-        stack_size += (max_args_num - 8) * 4;
-    }
-    stack_size = (stack_size + 15) & (~15);
-    stack_frame.set_stack_size(stack_size, store_ra, max_args_num);
-    if (stack_size < MAX_IMMEDIATE_VAL)
-    {
-        cout << "  addi sp, sp, " << -stack_size << endl;
-    }
-    else
+    for (uint32_t i = 0; i < func->bbs.len; i++)
     {
-        cout << "  li t0, " << -stack_size << endl;
-        cout << "  add sp, sp, t0" << endl;
+        koopa_raw_basic_block_t bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        if (bb->insts.len == 0)
+        {
+            continue;
+        }
+        koopa_raw_value_t last = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+        if (last->kind.tag != KOOPA_RVT_BRANCH)
+        {
+            continue;
+        }
+        koopa_raw_value_t cond = last->kind.data.branch.cond;
+        if (cond->kind.tag != KOOPA_RVT_BINARY || use_count[LocalIndex(cond)] != 1)
+        {
+            continue;
+        }
+        switch (cond->kind.data.binary.op)
+        {
+        case KOOPA_RBO_EQ:
+        case KOOPA_RBO_NOT_EQ:
+        case KOOPA_RBO_LT:
+        case KOOPA_RBO_GT:
+        case KOOPA_RBO_LE:
+        case KOOPA_RBO_GE:
+            break;
+        default:
+            continue;
+        }
+        for (uint32_t j = 0; j < bb->insts.len; j++)
+        {
+            if (bb->insts.buffer[j] == cond)
+            {
+                fctx->branch_conds[LocalIndex(cond)] = true;
+            }
+        }
     }
-    if(store_ra)
+}
+
+// 找出紧跟着 ret 并直接返回其结果的 call, 参数都用寄存器传递时可以在拆除栈帧后直接跳转到被调用的函数.
+// 这样的 call 和 ret 都加入 tail_calls, ret 本身不再生成代码
+void FindTailCalls(const koopa_raw_function_t &func)
+{
+    for (uint32_t i = 0; i < func->bbs.len; i++)
     {
-        GenLoadStoreInst("sw", "ra", stack_size-4, "sp");
+        koopa_raw_basic_block_t bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        if (bb->insts.len < 2)
+        {
+            continue;
+        }
+        koopa_raw_value_t call = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 2]);
+        koopa_raw_value_t ret = reinterpret_cast<koopa_raw_value_t>(bb->insts.buffer[bb->insts.len - 1]);
+        if (call->kind.tag != KOOPA_RVT_CALL || ret->kind.tag != KOOPA_RVT_RETURN || call->kind.data.call.args.len > PARAM_REG_NUM)
+        {
+            continue;
+        }
+        koopa_raw_value_t ret_value = ret->kind.data.ret.value;
+        if (ret_value == call || (ret_value == nullptr && call->ty->tag == KOOPA_RTT_UNIT))
+        {
+            fctx->tail_calls[LocalIndex(call)] = true;
+            fctx->tail_calls[LocalIndex(ret)] = true;
+        }
     }
-    for (int i = 0; i < func->params.len; i++)
+}
+
+// 参数在函数入口处复制到虚拟寄存器中, 第 9 个及以后的参数从调用者的栈帧中读取
+void LowerParams(const koopa_raw_function_t &func)
+{
+    MachineFunction &mf = fctx->mf;
+    for (uint32_t i = 0; i < func->params.len; i++)
     {
         koopa_raw_value_t param = reinterpret_cast<koopa_raw_value_t>(func->params.buffer[i]);
         var_info_t param_info;
+        param_info.type = VAR_TYPE::ON_REG;
+        param_info.reg_id = mf.NewVReg();
         if (i < PARAM_REG_NUM)
         {
-            param_info.type = VAR_TYPE::ON_REG;
-            param_info.reg_id = i + 7;
+            Emit(MakeInst(MOP_MV, param_info.reg_id, REG_A0 + i));
         }
         else
         {
-            param_info.type = VAR_TYPE::ON_STACK;
-            param_info.stack_location = stack_size + (i - 8) * 4;
+            machine_inst_t inst = MakeInst(MOP_LW, param_info.reg_id, REG_SP);
+            inst.frame_index = mf.frame.CreateObject(FrameObjectType::FO_INCOMING, i - PARAM_REG_NUM);
+            Emit(inst);
         }
-        is_visited[param] = param_info;
+        SetVar(param, param_info);
     }
 }
 
-void Epilogue()
+// 基本块参数各自分配一个虚拟寄存器, 由跳转到这个块的每条边把实参复制进去
+void LowerBlockParams(const koopa_raw_function_t &func)
 {
-    cout << endl << "  # epilogue" << endl;
-    int stack_size = stack_frame.get_stack_size();
-    bool store_ra = stack_frame.is_store_ra();
-    if (store_ra)
+    for (uint32_t i = 0; i < func->bbs.len; i++)
     {
-        GenLoadStoreInst("lw", "ra", stack_size - 4, "sp");
+        koopa_raw_basic_block_t bb = reinterpret_cast<koopa_raw_basic_block_t>(func->bbs.buffer[i]);
+        for (uint32_t j = 0; j < bb->params.len; j++)
+        {
+            var_info_t param_info;
+            param_info.type = VAR_TYPE::ON_REG;
+            param_info.reg_id = fctx->mf.NewVReg();
+            SetVar(reinterpret_cast<koopa_raw_value_t>(bb->params.buffer[j]), param_info);
+        }
     }
-    if (stack_size < MAX_IMMEDIATE_VAL)
+}
+
+// 把实参复制到目标块参数的虚拟寄存器中. 实参中有目标块自己的参数时 (例如循环中交换两个变量),
+// 先把所有实参复制到新的虚拟寄存器, 避免先复制的参数被后面的复制读到
+void EmitBlockArgs(const koopa_raw_basic_block_t &target, const koopa_raw_slice_t &args)
+{
+    vector<int> srcs;
+    bool reads_params = false;
+    for (uint32_t i = 0; i < args.len; i++)
     {
-        cout << "  addi sp, sp, " << stack_size << endl;
+        koopa_raw_value_t arg = reinterpret_cast<koopa_raw_value_t>(args.buffer[i]);
+        var_info_t var = Visit(arg);
+        assert(var.type == VAR_TYPE::ON_REG);
+        srcs.push_back(var.reg_id);
+        for (uint32_t j = 0; j < target->params.len; j++)
+        {
+            reads_params |= (target->params.buffer[j] == arg && j != i);
+        }
     }
-    else
+    if (reads_params)
     {
-        cout << "  li t0, " << stack_size << endl;
-        cout << "  add sp, sp, t0" << endl;
+        for (int &src: srcs)
+        {
+            int tmp = fctx->mf.NewVReg();
+            Emit(MakeInst(MOP_MV, tmp, src));
+            src = tmp;
+        }
+    }
+    for (uint32_t i = 0; i < args.len; i++)
+    {
+        var_info_t param;
+        bool found = FindVar(reinterpret_cast<koopa_raw_value_t>(target->params.buffer[i]), param);
+        assert(found);
+        if (param.reg_id != srcs[i])
+        {
+            Emit(MakeInst(MOP_MV, param.reg_id, srcs[i]));
+        }
     }
 }
 
-var_info_t Visit(const koopa_raw_value_t &value)
+// 条件跳转的边带有实参时, 在新建的块中复制实参后再跳到目标块, 返回条件跳转实际的目标.
+// 复制不能放在条件跳转之后: 活跃分析假定跳转只出现在块的末尾
+int EdgeTarget(const koopa_raw_basic_block_t &target, const koopa_raw_slice_t &args, const char *suffix)
 {
-    if (is_visited.find(value) != is_visited.end())
+    if (args.len == 0)
     {
-        var_info_t info = is_visited[value];
-        if (info.type == VAR_TYPE::ON_REG)
+        return GetBlockId(target);
+    }
+    MachineFunction &mf = fctx->mf;
+    int cur_block = fctx->cur_block;
+    fctx->cur_block = mf.NewBlock(mf.blocks[cur_block].name + suffix);
+    EmitBlockArgs(target, args);
+    machine_inst_t j = MakeInst(MOP_J);
+    j.target = GetBlockId(target);
+    Emit(j);
+    int edge_block = fctx->cur_block;
+    fctx->cur_block = cur_block;
+    return edge_block;
+}
+
+// 寄存器分配之后确定栈帧布局: 把栈帧对象换成 sp 加偏移量, 在入口插入序言, 在每个 ret / tail 之前插入尾声
+void LowerFrame(MachineFunction &mf)
+{
+    StackFrame &frame = mf.frame;
+    frame.store_ra = !mf.IsLeaf();
+    frame.Layout();
+    int stack_size = frame.stack_size;
+    auto adjust_sp = [&](vector<machine_inst_t> &insts, int size)
+    {
+        if (size == 0)
+        {
+            return;
+        }
+        if (IsImm12(size))
         {
-            return info;
+            insts.push_back(MakeInst(MOP_ADDI, REG_SP, REG_SP, NO_REG, size));
         }
-        else if(info.type == VAR_TYPE::ON_STACK)
+        else
         {
-            int location = info.stack_location;
-            assert(location >= 0);
-            int reg_id = reg_manager.alloc_reg();
-            GenLoadStoreInst("lw", gen_reg(reg_id), location, "sp");
-            info.type = VAR_TYPE::ON_REG;
-            info.reg_id = reg_id;
-            return info;
+            insts.push_back(MakeInst(MOP_LI, SCRATCH_REG2, NO_REG, NO_REG, size));
+            insts.push_back(MakeInst(MOP_ADD, REG_SP, REG_SP, SCRATCH_REG2));
         }
-        else if (info.type == VAR_TYPE::ON_GLOBAL)
+    };
+    for (size_t b = 0; b < mf.blocks.size(); b++)
+    {
+        machine_block_t &block = mf.blocks[b];
+        vector<machine_inst_t> insts;
+        insts.reserve(block.insts.size());
+        if (b == 0)
         {
-            int reg_id = reg_manager.alloc_reg();
-            cout << "  la " << gen_reg(reg_id) << ", " << is_visited[value].global_name << endl;
-            cout << "  lw " << gen_reg(reg_id) << ", 0(" << gen_reg(reg_id) << ")" << endl;
-            info.type = VAR_TYPE::ON_REG;
-            info.reg_id = reg_id;
-            return info;
+            adjust_sp(insts, -stack_size);
+            if (frame.store_ra)
+            {
+                GenLoadStoreInst(insts, MOP_SW, REG_RA, frame.RaOffset(), SCRATCH_REG2);
+            }
+            for (size_t i = 0; i < frame.saved_regs.size(); i++)
+            {
+                GenLoadStoreInst(insts, MOP_SW, frame.saved_regs[i], frame.SavedRegOffset(i), SCRATCH_REG2);
+            }
         }
+        for (const machine_inst_t &inst: block.insts)
+        {
+            if (inst.op == MOP_RET || inst.op == MOP_TAIL)
+            {
+                if (frame.store_ra)
+                {
+                    GenLoadStoreInst(insts, MOP_LW, REG_RA, frame.RaOffset(), SCRATCH_REG2);
+                }
+                for (size_t i = 0; i < frame.saved_regs.size(); i++)
+                {
+                    GenLoadStoreInst(insts, MOP_LW, frame.saved_regs[i], frame.SavedRegOffset(i), SCRATCH_REG2);
+                }
+                adjust_sp(insts, stack_size);
+                insts.push_back(inst);
+            }
+            else if (inst.frame_index >= 0)
+            {
+                int offset = frame.ObjectOffset(inst.frame_index);
+                if (inst.op == MOP_LW)
+                {
+                    GenLoadStoreInst(insts, MOP_LW, inst.rd, offset, inst.rd);
+                }
+                else
+                {
+                    GenLoadStoreInst(insts, MOP_SW, inst.rs2, offset, inst.rs2 == SCRATCH_REG2 ? SCRATCH_REG1 : SCRATCH_REG2);
+                }
+            }
+            else
+            {
+                insts.push_back(inst);
+            }
+        }
+        block.insts.swap(insts);
+    }
+}
+
+var_info_t Visit(const koopa_raw_value_t &value)
+{
+    var_info_t info;
+    if (FindVar(value, info))
+    {
+        return info;
     }
     const auto &kind = value->kind;
-    var_info_t vinfo;
+    // 不产生值的指令 (ret, br, store 等) 返回的位置没有意义, 但也要初始化
+    var_info_t vinfo{};
+    vinfo.frame_index = -1;
+    vinfo.global_id = -1;
     bool is_ret = (value->ty->tag != KOOPA_RTT_UNIT);
     switch (kind.tag)
     {
     case KOOPA_RVT_RETURN:
+        if (fctx->tail_calls[LocalIndex(value)])
+        {
+            break;
+        }
         Visit(kind.data.ret);
-        reg_manager.free_regs();
         break;
     case KOOPA_RVT_INTEGER:
         vinfo = Visit(kind.data.integer);
         break;
     case KOOPA_RVT_BINARY:
+        if (fctx->branch_conds[LocalIndex(value)])
+        {
+            break;
+        }
         vinfo = Visit(kind.data.binary);
-        is_visited[value] = vinfo;
-        reg_manager.free_regs();
+        SetVar(value, vinfo);
         break;
     case KOOPA_RVT_ALLOC:
-        cout << endl << "  # alloc" << endl;
         vinfo.type = VAR_TYPE::ON_STACK;
-        vinfo.stack_location = stack_frame.push();
-        is_visited[value] = vinfo;
-        reg_manager.free_regs();
+        vinfo.frame_index = fctx->mf.frame.CreateObject(FrameObjectType::FO_LOCAL);
+        SetVar(value, vinfo);
         break;
     case KOOPA_RVT_BRANCH:
         Visit(kind.data.branch);
@@ -394,22 +626,14 @@ var_info_t Visit(const koopa_raw_value_t &value)
         break;
     case KOOPA_RVT_STORE:
         Visit(kind.data.store);
-        reg_manager.free_regs();
         break;
     case KOOPA_RVT_LOAD:
         vinfo = Visit(kind.data.load);
-        is_visited[value] = vinfo;
-        reg_manager.free_regs();
+        SetVar(value, vinfo);
         break;
     case KOOPA_RVT_CALL:
-        vinfo = Visit(kind.data.call, is_ret);
-        is_visited[value] = vinfo;
-        reg_manager.free_regs();
-        break;
-    case KOOPA_RVT_GLOBAL_ALLOC:
-        vinfo = Visit(kind.data.global_alloc);
-        assert(vinfo.type == VAR_TYPE::ON_GLOBAL);
-        is_visited[value] = vinfo;
+        vinfo = Visit(kind.data.call, is_ret, fctx->tail_calls[LocalIndex(value)]);
+        SetVar(value, vinfo);
         break;
     default:
         assert(false);
@@ -417,45 +641,46 @@ var_info_t Visit(const koopa_raw_value_t &value)
     return vinfo;
 }
 
+// 整数常量在每次使用处重新生成, 0 直接使用 x0
 var_info_t Visit(const koopa_raw_integer_t &interger)
 {
     int32_t value = interger.value;
-    var_info_t vinfo;
+    var_info_t vinfo{};
+    vinfo.frame_index = -1;
+    vinfo.global_id = -1;
     vinfo.type = VAR_TYPE::ON_REG;
     if (value == 0)
     {
-        vinfo.reg_id = ZERO_REG_ID;
+        vinfo.reg_id = REG_ZERO;
         return vinfo;
     }
-    int new_reg_id = reg_manager.alloc_reg();
-    vinfo.reg_id = new_reg_id;
-    string reg = gen_reg(new_reg_id);
-    cout << "  li " << reg << ", " << to_string(value) << endl;
+    vinfo.reg_id = fctx->mf.NewVReg();
+    Emit(MakeInst(MOP_LI, vinfo.reg_id, NO_REG, NO_REG, value));
     return vinfo;
 }
 
 var_info_t Visit(const koopa_raw_binary_t &binary)
 {
-    cout << endl << "  # binary" << endl;
-    var_info_t lvar = Visit(binary.lhs);
-    var_info_t rvar = Visit(binary.rhs);
-    if (lvar.type == VAR_TYPE::ON_STACK)
+    koopa_raw_value_t lhs = binary.lhs, rhs = binary.rhs;
+    koopa_raw_binary_op_t op = binary.op;
+    // 常量在左边时交换操作数, 使常量尽量出现在右边
+    if (lhs->kind.tag == KOOPA_RVT_INTEGER && rhs->kind.tag != KOOPA_RVT_INTEGER && swapped_ops[op] >= 0)
     {
-        lvar.type = VAR_TYPE::ON_REG;
-        lvar.reg_id = reg_manager.alloc_reg();
-        GenLoadStoreInst("lw", gen_reg(lvar.reg_id), lvar.stack_location, "sp");
+        swap(lhs, rhs);
+        op = (koopa_raw_binary_op_t)swapped_ops[op];
     }
-    if (rvar.type == VAR_TYPE::ON_STACK)
+    var_info_t lvar = Visit(lhs);
+    assert(lvar.type == VAR_TYPE::ON_REG);
+    var_info_t res;
+    res.type = VAR_TYPE::ON_REG;
+    res.reg_id = fctx->mf.NewVReg();
+    if (rhs->kind.tag == KOOPA_RVT_INTEGER && SelectImmBinary(op, res.reg_id, lvar.reg_id, rhs->kind.data.integer.value))
     {
-        rvar.type = VAR_TYPE::ON_REG;
-        rvar.reg_id = reg_manager.alloc_reg();
-        GenLoadStoreInst("lw", gen_reg(rvar.reg_id), rvar.stack_location, "sp");
+        return res;
     }
-    var_info_t tmp_result;
-    tmp_result.type = VAR_TYPE::ON_REG;
-    tmp_result.reg_id = reg_manager.alloc_reg();
-    string new_reg = gen_reg(tmp_result.reg_id), l_reg = gen_reg(lvar.reg_id), r_reg = gen_reg(rvar.reg_id);
-    koopa_raw_binary_op_t op = binary.op;
+    var_info_t rvar = Visit(rhs);
+    assert(rvar.type == VAR_TYPE::ON_REG);
+    int new_reg = res.reg_id, l_reg = lvar.reg_id, r_reg = rvar.reg_id;
     switch (op)
     {
     case KOOPA_RBO_GT:
@@ -467,124 +692,481 @@ var_info_t Visit(const koopa_raw_binary_t &binary)
     case KOOPA_RBO_MOD:
     case KOOPA_RBO_AND:
     case KOOPA_RBO_OR:
-        cout << "  " << op_names[op] << " " << new_reg << ", " << l_reg << ", " << r_reg << endl;
+        Emit(MakeInst(op_names[op], new_reg, l_reg, r_reg));
         break;
     case KOOPA_RBO_EQ:
-        cout << "  xor " << new_reg << ", " << l_reg << ", " << r_reg << endl;
-        cout << "  seqz " << new_reg << ", " << new_reg << endl;
+        Emit(MakeInst(MOP_XOR, new_reg, l_reg, r_reg));
+        Emit(MakeInst(MOP_SEQZ, new_reg, new_reg));
         break;
     case KOOPA_RBO_NOT_EQ:
-        cout << "  xor " << new_reg << ", " << l_reg << ", " << r_reg << endl;
-        cout << "  snez " << new_reg << ", " << new_reg << endl;;
+        Emit(MakeInst(MOP_XOR, new_reg, l_reg, r_reg));
+        Emit(MakeInst(MOP_SNEZ, new_reg, new_reg));
         break;
-    case KOOPA_RBO_LE:  
-        cout << "  sgt " << new_reg << ", " << l_reg << ", " << r_reg << endl;
-        cout << "  xori " << new_reg << ", " << new_reg << ", 1" << endl;
+    case KOOPA_RBO_LE:
+        Emit(MakeInst(MOP_SGT, new_reg, l_reg, r_reg));
+        Emit(MakeInst(MOP_XORI, new_reg, new_reg, NO_REG, 1));
         break;
     case KOOPA_RBO_GE:
-        cout << "  slt " << new_reg << ", " << l_reg << ", " << r_reg << endl;
-        cout << "  xori " << new_reg << ", " << new_reg << ", 1" << endl;
+        Emit(MakeInst(MOP_SLT, new_reg, l_reg, r_reg));
+        Emit(MakeInst(MOP_XORI, new_reg, new_reg, NO_REG, 1));
+        break;
+    default:
+        assert(false);
     }
-    var_info_t res;
-    res.type = VAR_TYPE::ON_STACK;
-    res.stack_location = stack_frame.push();
-    GenLoadStoreInst("sw", new_reg, res.stack_location,"sp");
     return res;
 }
 
-var_info_t Visit(const koopa_raw_load_t &load)
+// 右操作数是常量时使用立即数形式的指令, 不能使用时返回 false
+bool SelectImmBinary(koopa_raw_binary_op_t op, int new_reg, int l_reg, int32_t imm)
 {
-    cout << endl << "  # load" << endl;
-    var_info_t src_var = Visit(load.src);
-    assert(src_var.type == VAR_TYPE::ON_REG);
-    var_info_t dst_var;
-    dst_var.type = VAR_TYPE::ON_STACK;
-    dst_var.stack_location = stack_frame.push();
-    GenLoadStoreInst("sw", gen_reg(src_var.reg_id), dst_var.stack_location, "sp");
-    return dst_var;
+    int64_t next = (int64_t)imm + 1;
+    switch (op)
+    {
+    case KOOPA_RBO_ADD:
+        if (!IsImm12(imm))
+        {
+            return false;
+        }
+        Emit(MakeInst(MOP_ADDI, new_reg, l_reg, NO_REG, imm));
+        return true;
+    case KOOPA_RBO_SUB:
+        if (!IsImm12(-(int64_t)imm))
+        {
+            return false;
+        }
+        Emit(MakeInst(MOP_ADDI, new_reg, l_reg, NO_REG, -imm));
+        return true;
+    case KOOPA_RBO_AND:
+    case KOOPA_RBO_OR:
+        if (!IsImm12(imm))
+        {
+            return false;
+        }
+        Emit(MakeInst(op == KOOPA_RBO_AND ? MOP_ANDI : MOP_ORI, new_reg, l_reg, NO_REG, imm));
+        return true;
+    case KOOPA_RBO_EQ:
+    case KOOPA_RBO_NOT_EQ:
+    {
+        MachineOp set_op = (op == KOOPA_RBO_EQ) ? MOP_SEQZ : MOP_SNEZ;
+        if (imm == 0)
+        {
+            Emit(MakeInst(set_op, new_reg, l_reg));
+            return true;
+        }
+        if (!IsImm12(imm))
+        {
+            return false;
+        }
+        Emit(MakeInst(MOP_XORI, new_reg, l_reg, NO_REG, imm));
+        Emit(MakeInst(set_op, new_reg, new_reg));
+        return true;
+    }
+    case KOOPA_RBO_LT:
+        // l < c
+        if (!IsImm12(imm))
+        {
+            return false;
+        }
+        Emit(MakeInst(MOP_SLTI, new_reg, l_reg, NO_REG, imm));
+        return true;
+    case KOOPA_RBO_LE:
+        // l <= c  <=>  l < c + 1
+        if (!IsImm12(next))
+        {
+            return false;
+        }
+        Emit(MakeInst(MOP_SLTI, new_reg, l_reg, NO_REG, next));
+        return true;
+    case KOOPA_RBO_GT:
+        // l > c  <=>  !(l < c + 1)
+        if (!IsImm12(next))
+        {
+            return false;
+        }
+        Emit(MakeInst(MOP_SLTI, new_reg, l_reg, NO_REG, next));
+        Emit(MakeInst(MOP_XORI, new_reg, new_reg, NO_REG, 1));
+        return true;
+    case KOOPA_RBO_GE:
+        // l >= c  <=>  !(l < c)
+        if (!IsImm12(imm))
+        {
+            return false;
+        }
+        Emit(MakeInst(MOP_SLTI, new_reg, l_reg, NO_REG, imm));
+        Emit(MakeInst(MOP_XORI, new_reg, new_reg, NO_REG, 1));
+        return true;
+    case KOOPA_RBO_MUL:
+        return ctx->opt_level >= 1 && SelectMulConst(new_reg, l_reg, imm);
+    case KOOPA_RBO_DIV:
+    case KOOPA_RBO_MOD:
+        return ctx->opt_level >= 1 && SelectDivConst(new_reg, l_reg, imm, op == KOOPA_RBO_MOD);
+    default:
+        return false;
+    }
 }
 
-var_info_t Visit(const koopa_raw_call_t &call, bool is_ret)
+// 乘以常量: 0, +-2^k, +-(2^a + 2^b), +-(2^a - 2^b) 改为移位和加减, 最多 3 条指令, 否则仍使用 mul
+bool SelectMulConst(int new_reg, int l_reg, int32_t imm)
 {
-    cout << endl << "  # func" << endl;
-    reg_manager.free_regs();
-    for (int i = 0; i < call.args.len; i++)
+    MachineFunction &mf = fctx->mf;
+    if (imm == 0)
     {
-        koopa_raw_value_t arg = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]);
-        var_info_t info = Visit(arg);
-        if (i < PARAM_REG_NUM)
+        Emit(MakeInst(MOP_MV, new_reg, REG_ZERO));
+        return true;
+    }
+    uint32_t abs_imm = (imm < 0) ? -(uint32_t)imm : imm;
+    int neg_cost = (imm < 0) ? 1 : 0;
+    // 生成 l << shift, shift 为 0 时直接使用 l
+    auto shifted = [&](int shift)
+    {
+        if (shift == 0)
+        {
+            return l_reg;
+        }
+        int reg = mf.NewVReg();
+        Emit(MakeInst(MOP_SLLI, reg, l_reg, NO_REG, shift));
+        return reg;
+    };
+    int result = NO_REG;
+    int low = __builtin_ctz(abs_imm);
+    uint32_t rest = abs_imm - (1u << low);
+    if (rest == 0)
+    {
+        if (low == 0 && imm > 0)
+        {
+            // 乘以 1
+            Emit(MakeInst(MOP_MV, new_reg, l_reg));
+            return true;
+        }
+        result = shifted(low);
+    }
+    else if ((rest & (rest - 1)) == 0 && (low == 0 ? 2 : 3) + neg_cost <= 3)
+    {
+        // 2^a + 2^b
+        int high = __builtin_ctz(rest);
+        int a = shifted(high), b = shifted(low);
+        result = mf.NewVReg();
+        Emit(MakeInst(MOP_ADD, result, a, b));
+    }
+    else
+    {
+        // 2^a - 2^b: abs_imm + 2^b 是 2 的幂
+        uint64_t sum = (uint64_t)abs_imm + (1u << low);
+        if ((sum & (sum - 1)) != 0 || sum > (1ull << 31) || (low == 0 ? 2 : 3) + neg_cost > 3)
+        {
+            return false;
+        }
+        int a = shifted(__builtin_ctzll(sum)), b = shifted(low);
+        result = mf.NewVReg();
+        Emit(MakeInst(MOP_SUB, result, a, b));
+    }
+    if (imm < 0)
+    {
+        Emit(MakeInst(MOP_SUB, new_reg, REG_ZERO, result));
+    }
+    else
+    {
+        Emit(MakeInst(MOP_MV, new_reg, result));
+    }
+    return true;
+}
+
+// 有符号除以常量 (向零取整) 和取余:
+// 除数是 2 的幂时, 负数先加上 2^k - 1 再算术右移; 否则使用 mulh 乘以魔数 (Hacker's Delight 10-4).
+// 取余为 n - (n / c) * c, 与除数的符号无关. 除数为 0 或 INT_MIN 时仍使用 div / rem.
+bool SelectDivConst(int new_reg, int l_reg, int32_t imm, bool is_rem)
+{
+    MachineFunction &mf = fctx->mf;
+    if (imm == 0 || imm == INT32_MIN)
+    {
+        return false;
+    }
+    uint32_t d = (imm < 0) ? -(uint32_t)imm : imm;
+    if (d == 1)
+    {
+        if (is_rem)
         {
-            if (i + 7 != info.reg_id)
+            Emit(MakeInst(MOP_MV, new_reg, REG_ZERO));
+        }
+        else
+        {
+            Emit(MakeInst(imm < 0 ? MOP_SUB : MOP_MV, new_reg, imm < 0 ? REG_ZERO : l_reg, imm < 0 ? l_reg : NO_REG));
+        }
+        return true;
+    }
+    int quot = mf.NewVReg();
+    if ((d & (d - 1)) == 0)
+    {
+        int k = __builtin_ctz(d);
+        // bias = n < 0 ? 2^k - 1 : 0
+        int sign = l_reg;
+        if (k > 1)
+        {
+            sign = mf.NewVReg();
+            Emit(MakeInst(MOP_SRAI, sign, l_reg, NO_REG, 31));
+        }
+        int bias = mf.NewVReg();
+        Emit(MakeInst(MOP_SRLI, bias, sign, NO_REG, 32 - k));
+        int biased = mf.NewVReg();
+        Emit(MakeInst(MOP_ADD, biased, l_reg, bias));
+        if (is_rem)
+        {
+            // n - (biased & -2^k)
+            int rounded = mf.NewVReg();
+            if (IsImm12(-(int64_t)d))
             {
-                reg_manager.alloc_reg(i + 7);
-                cout << "  mv " << gen_reg(i + 7) << ", " << gen_reg(info.reg_id) << endl;
-                reg_manager.free(info.reg_id);
+                Emit(MakeInst(MOP_ANDI, rounded, biased, NO_REG, -(int32_t)d));
             }
+            else
+            {
+                int mask = mf.NewVReg();
+                Emit(MakeInst(MOP_LI, mask, NO_REG, NO_REG, -(int32_t)d));
+                Emit(MakeInst(MOP_AND, rounded, biased, mask));
+            }
+            Emit(MakeInst(MOP_SUB, new_reg, l_reg, rounded));
+            return true;
         }
-        else
-        {   
-            GenLoadStoreInst("sw", gen_reg(info.reg_id), (i-8) * 4, "sp");
-            reg_manager.free(info.reg_id);
+        Emit(MakeInst(MOP_SRAI, quot, biased, NO_REG, k));
+    }
+    else
+    {
+        // 求魔数 magic 和移位量 shift, 使 n / d == (mulh(n, magic) (+ n)) >> shift, 负数商再加 1
+        const uint32_t two31 = 0x80000000u;
+        uint32_t anc = two31 - 1 - two31 % d;
+        int p = 31;
+        uint32_t q1 = two31 / anc, r1 = two31 - q1 * anc;
+        uint32_t q2 = two31 / d, r2 = two31 - q2 * d;
+        uint32_t delta;
+        do
+        {
+            p++;
+            q1 = 2 * q1;
+            r1 = 2 * r1;
+            if (r1 >= anc)
+            {
+                q1++;
+                r1 -= anc;
+            }
+            q2 = 2 * q2;
+            r2 = 2 * r2;
+            if (r2 >= d)
+            {
+                q2++;
+                r2 -= d;
+            }
+            delta = d - r2;
+        } while (q1 < delta || (q1 == delta && r1 == 0));
+        int32_t magic = (int32_t)(q2 + 1);
+        int shift = p - 32;
+        int magic_reg = mf.NewVReg();
+        Emit(MakeInst(MOP_LI, magic_reg, NO_REG, NO_REG, magic));
+        int high = mf.NewVReg();
+        Emit(MakeInst(MOP_MULH, high, l_reg, magic_reg));
+        if (magic < 0)
+        {
+            int sum = mf.NewVReg();
+            Emit(MakeInst(MOP_ADD, sum, high, l_reg));
+            high = sum;
+        }
+        if (shift > 0)
+        {
+            int shifted = mf.NewVReg();
+            Emit(MakeInst(MOP_SRAI, shifted, high, NO_REG, shift));
+            high = shifted;
         }
+        int sign = mf.NewVReg();
+        Emit(MakeInst(MOP_SRLI, sign, l_reg, NO_REG, 31));
+        Emit(MakeInst(MOP_ADD, quot, high, sign));
     }
-    cout << "  call " << call.callee->name + 1 << endl;
-    var_info_t info;
-    if (is_ret)
+    if (is_rem)
+    {
+        // n - q * d
+        int product = mf.NewVReg();
+        if (!SelectMulConst(product, quot, d))
+        {
+            int d_reg = mf.NewVReg();
+            Emit(MakeInst(MOP_LI, d_reg, NO_REG, NO_REG, d));
+            Emit(MakeInst(MOP_MUL, product, quot, d_reg));
+        }
+        Emit(MakeInst(MOP_SUB, new_reg, l_reg, product));
+        return true;
+    }
+    if (imm < 0)
+    {
+        Emit(MakeInst(MOP_SUB, new_reg, REG_ZERO, quot));
+    }
+    else
+    {
+        Emit(MakeInst(MOP_MV, new_reg, quot));
+    }
+    return true;
+}
+
+var_info_t Visit(const koopa_raw_load_t &load)
+{
+    var_info_t src_var;
+    bool found = FindVar(load.src, src_var);
+    assert(found);
+    var_info_t dst_var;
+    dst_var.type = VAR_TYPE::ON_REG;
+    dst_var.reg_id = fctx->mf.NewVReg();
+    if (src_var.type == VAR_TYPE::ON_GLOBAL)
+    {
+        machine_inst_t inst = MakeInst(MOP_LW, dst_var.reg_id, GlobalBase(src_var.global_id));
+        inst.global_id = src_var.global_id;
+        Emit(inst);
+    }
+    else
+    {
+        machine_inst_t inst = MakeInst(MOP_LW, dst_var.reg_id, REG_SP);
+        inst.frame_index = src_var.frame_index;
+        Emit(inst);
+    }
+    return dst_var;
+}
+
+// 前 8 个参数放在 a0 - a7 中, 其余的参数写到栈帧底部的参数区. 尾调用的返回值直接留在 a0 中交给调用者
+var_info_t Visit(const koopa_raw_call_t &call, bool is_ret, bool is_tail)
+{
+    MachineFunction &mf = fctx->mf;
+    vector<int> arg_regs;
+    for (uint32_t i = 0; i < call.args.len; i++)
+    {
+        koopa_raw_value_t arg = reinterpret_cast<koopa_raw_value_t>(call.args.buffer[i]);
+        var_info_t info = Visit(arg);
+        assert(info.type == VAR_TYPE::ON_REG);
+        arg_regs.push_back(info.reg_id);
+    }
+    for (uint32_t i = PARAM_REG_NUM; i < call.args.len; i++)
+    {
+        Emit(MakeInst(MOP_SW, NO_REG, REG_SP, arg_regs[i], (i - PARAM_REG_NUM) * 4));
+    }
+    if (call.args.len > PARAM_REG_NUM)
+    {
+        mf.frame.outgoing_size = max(mf.frame.outgoing_size, (int)(call.args.len - PARAM_REG_NUM) * 4);
+    }
+    int reg_args = min((int)call.args.len, PARAM_REG_NUM);
+    for (int i = 0; i < reg_args; i++)
+    {
+        Emit(MakeInst(MOP_MV, REG_A0 + i, arg_regs[i]));
+    }
+    machine_inst_t inst = MakeInst(is_tail ? MOP_TAIL : MOP_CALL, NO_REG, NO_REG, NO_REG, reg_args);
+    inst.symbol = call.callee->name + 1;
+    Emit(inst);
+    // 跨过调用的 lui 结果要占用 callee-saved 寄存器或者溢出, 不如在调用之后重新生成
+    fill(fctx->global_bases.begin(), fctx->global_bases.end(), make_pair(-1, NO_REG));
+    var_info_t info{};
+    info.frame_index = -1;
+    info.global_id = -1;
+    if (is_ret && !is_tail)
     {
-        info.type = VAR_TYPE::ON_STACK;
-        info.stack_location = stack_frame.push();
-        GenLoadStoreInst("sw", "a0", info.stack_location, "sp");
+        info.type = VAR_TYPE::ON_REG;
+        info.reg_id = mf.NewVReg();
+        Emit(MakeInst(MOP_MV, info.reg_id, REG_A0));
     }
     return info;
 }
 
 var_info_t Visit(const koopa_raw_global_alloc_t &global_alloc)
 {
-    string gname = "g_" + to_string(global_count++);
-    cout << endl << "  # global alloc" << endl;
-    cout << "  .data" << endl;
-    cout << "  .globl " << gname << endl;
-    cout << gname << ":" << endl;
+    int global_id = ctx->global_count++;
     const auto &kind = global_alloc.init->kind.tag;
+    ctx->emitter << "\n  # global alloc\n";
+    // 全局变量都只有 4 字节, 放在 small data 段中, 链接器把它们放在 gp 附近
+    ctx->emitter << ((kind == KOOPA_RVT_ZERO_INIT) ? "  .section .sbss\n" : "  .section .sdata\n");
+    ctx->emitter << "  .globl g_" << global_id << '\n';
+    ctx->emitter << "g_" << global_id << ":\n";
     switch (kind)
     {
         case KOOPA_RVT_ZERO_INIT:
-            cout << "  .zero 4" << endl;
+            ctx->emitter << "  .zero 4\n";
             break;
         case KOOPA_RVT_INTEGER:
-            cout << "  .word " << global_alloc.init->kind.data.integer.value << endl;
+            ctx->emitter << "  .word " << global_alloc.init->kind.data.integer.value << '\n';
             break;
         default:
             assert(false);
     }
-    var_info_t vinfo;
+    var_info_t vinfo{};
     vinfo.type = VAR_TYPE::ON_GLOBAL;
-    vinfo.global_name = gname;
-    cout << endl;
+    vinfo.frame_index = -1;
+    vinfo.global_id = global_id;
+    ctx->emitter << '\n';
     return vinfo;
 }
 
-string gen_reg(int id)
+// 全局变量按编号在 ctx->global_vars 中查找, 当前函数中的值按编号在 fctx->values 中查找
+bool FindVar(const koopa_raw_value_t &value, var_info_t &info)
 {
-    if (id <= REG_NUM)
+    if (value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC)
     {
-        return regs[id];
+        info = ctx->global_vars[ValueIndex(value)];
+        return true;
     }
-    assert(false);
+    int index = LocalIndex(value);
+    if (index < 0 || !fctx->is_visited[index])
+    {
+        return false;
+    }
+    info = fctx->values[index];
+    return true;
+}
+
+void SetVar(const koopa_raw_value_t &value, const var_info_t &info)
+{
+    int index = LocalIndex(value);
+    fctx->values[index] = info;
+    fctx->is_visited[index] = true;
+}
+
+// 当前函数中的值的编号, 整数常量和全局变量返回 -1
+int LocalIndex(const koopa_raw_value_t &value)
+{
+    return (value->kind.tag == KOOPA_RVT_GLOBAL_ALLOC) ? -1 : ValueIndex(value);
+}
+
+// 机器代码中的基本块与 IR 中的基本块顺序相同
+int GetBlockId(const koopa_raw_basic_block_t &bb)
+{
+    return BlockIndex(bb);
 }
 
-void GenLoadStoreInst(string op, string reg1, int imm, string reg2)
+// 全局变量用 lui %hi + lw / sw %lo 访问, 它们都在 .sdata / .sbss 中, 链接器可以把这一对指令松弛为一条相对 gp 的访存.
+// -O1 及以上同一个基本块中两次调用之间对同一个全局变量的访问共用一条 lui
+int GlobalBase(int global_id)
 {
-    if (imm < MAX_IMMEDIATE_VAL)
+    pair<int, int> &cached = fctx->global_bases[global_id];
+    if (cached.first == fctx->cur_block)
     {
-        cout << "  " << op << " " << reg1 << ", " << imm << "(" << reg2 << ")" << endl;
+        return cached.second;
+    }
+    int base = fctx->mf.NewVReg();
+    Emit(MakeInst(MOP_LUI, base, NO_REG, NO_REG, global_id));
+    if (ctx->opt_level >= 1)
+    {
+        cached = make_pair(fctx->cur_block, base);
+    }
+    return base;
+}
+
+void Emit(const machine_inst_t &inst)
+{
+    fctx->mf.Emit(fctx->cur_block, inst);
+}
+
+// 以 sp 为基址读写栈帧, 偏移量超出 12 位立即数时先用 scratch 计算地址
+void GenLoadStoreInst(vector<machine_inst_t> &insts, MachineOp op, int reg, int imm, int scratch)
+{
+    int rd = (op == MOP_LW) ? reg : NO_REG;
+    int rs2 = (op == MOP_SW) ? reg : NO_REG;
+    if (IsImm12(imm))
+    {
+        insts.push_back(MakeInst(op, rd, REG_SP, rs2, imm));
     }
     else
     {
-        int reg_id = reg_manager.alloc_reg();
-        string reg_tmp = gen_reg(reg_id);
-        cout << "  li " << reg_tmp << ", " << imm << endl;
-        cout << "  add " << reg_tmp << ", " << reg_tmp << ", " << reg2 << endl;
-        cout << "  " << op << " " << reg1 << ", " << 0 << "(" << reg_tmp << ")" << endl;
+        insts.push_back(MakeInst(MOP_LI, scratch, NO_REG, NO_REG, imm));
+        insts.push_back(MakeInst(MOP_ADD, scratch, scratch, REG_SP));
+        insts.push_back(MakeInst(op, rd, scratch, rs2, 0));
     }
-}
\ No newline at end of file
+}
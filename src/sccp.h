@@ -0,0 +1,414 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "cfg.h"
+#include "ir.h"
+#include "koopa.h"
+
+using namespace std;
+
+// 稀疏条件常量传播 (Wegman, Zadeck), 在 mem2reg 之后的 SSA 形式上运行. 所有值先乐观地假定为未定 (TOP),
+// 只有可执行的边才把实参传给块参数, 条件为常量的 br 只有一条出边可执行; 值的格只会下降,
+// 每次下降时重新求值它的使用者. 收敛后常量值的使用替换为整数常量, 常量的块参数连同实参一起删除,
+// 条件为常量的 br 改为 jump, 最后删除因此不可达的基本块.
+
+enum LatticeState{LAT_TOP, LAT_CONST, LAT_BOTTOM};
+
+typedef struct
+{
+    LatticeState state;
+    int32_t value;
+} lattice_t;
+
+// 两个操作数都是常量时的运算结果, 除以 0 等无法在编译期确定的情况返回 false
+inline bool FoldBinary(koopa_raw_binary_op_t op, int32_t lhs, int32_t rhs, int32_t &result)
+{
+    uint32_t ul = lhs, ur = rhs;
+    switch (op)
+    {
+    case KOOPA_RBO_NOT_EQ:
+        result = (lhs != rhs);
+        return true;
+    case KOOPA_RBO_EQ:
+        result = (lhs == rhs);
+        return true;
+    case KOOPA_RBO_GT:
+        result = (lhs > rhs);
+        return true;
+    case KOOPA_RBO_LT:
+        result = (lhs < rhs);
+        return true;
+    case KOOPA_RBO_GE:
+        result = (lhs >= rhs);
+        return true;
+    case KOOPA_RBO_LE:
+        result = (lhs <= rhs);
+        return true;
+    case KOOPA_RBO_ADD:
+        result = (int32_t)(ul + ur);
+        return true;
+    case KOOPA_RBO_SUB:
+        result = (int32_t)(ul - ur);
+        return true;
+    case KOOPA_RBO_MUL:
+        result = (int32_t)(ul * ur);
+        return true;
+    case KOOPA_RBO_DIV:
+    case KOOPA_RBO_MOD:
+        if (rhs == 0 || (lhs == INT32_MIN && rhs == -1))
+        {
+            return false;
+        }
+        result = (op == KOOPA_RBO_DIV) ? lhs / rhs : lhs % rhs;
+        return true;
+    case KOOPA_RBO_AND:
+        result = lhs & rhs;
+        return true;
+    case KOOPA_RBO_OR:
+        result = lhs | rhs;
+        return true;
+    case KOOPA_RBO_XOR:
+        result = lhs ^ rhs;
+        return true;
+    case KOOPA_RBO_SHL:
+    case KOOPA_RBO_SHR:
+    case KOOPA_RBO_SAR:
+        if (rhs < 0 || rhs > 31)
+        {
+            return false;
+        }
+        result = (op == KOOPA_RBO_SHL) ? (int32_t)(ul << rhs) : (op == KOOPA_RBO_SHR) ? (int32_t)(ul >> rhs) : (lhs >> rhs);
+        return true;
+    default:
+        return false;
+    }
+}
+
+typedef struct
+{
+    int block;
+    int edge;
+    int pos;
+} arg_use_t;
+
+class SCCP
+{
+private:
+    IRBuilder &builder;
+    IRFunction *func;
+    // 以下数组以 index 为下标, 运行期间参数, 块参数和指令的 index 暂时记录它们在 values 中的位置
+    vector<IRValue *> values;
+    vector<int> value_block;
+    vector<lattice_t> lattice;
+    vector<vector<int> > users;
+    // 作为跳转实参的使用: (所在块, 出边编号, 实参位置)
+    vector<vector<arg_use_t> > arg_users;
+    vector<IRBasicBlock *> blocks;
+    vector<bool> block_executable;
+    // 每个块的出边按 ForEachSuccessor 的顺序编号: br 的 true 边为 0, false 边为 1, jump 的边为 0
+    vector<vector<bool> > edge_executable;
+    vector<pair<int, int> > edge_worklist;
+    vector<int> value_worklist;
+
+    void NumberValues()
+    {
+        for (const void *param: func->param_list)
+        {
+            AsIRValue(param)->index = values.size();
+            values.push_back(AsIRValue(param));
+            value_block.push_back(-1);
+        }
+        for (size_t b = 0; b < func->bb_list.size(); b++)
+        {
+            blocks.push_back(AsIRBlock(func->bb_list[b]));
+            blocks[b]->index = b;
+            for (const void *param: blocks[b]->param_list)
+            {
+                AsIRValue(param)->index = values.size();
+                values.push_back(AsIRValue(param));
+                value_block.push_back(b);
+            }
+            for (const void *inst: blocks[b]->inst_list)
+            {
+                AsIRValue(inst)->index = values.size();
+                values.push_back(AsIRValue(inst));
+                value_block.push_back(b);
+            }
+        }
+        lattice.assign(values.size(), lattice_t{LAT_TOP, 0});
+        users.resize(values.size());
+        arg_users.resize(values.size());
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            if (values[i]->kind.tag == KOOPA_RVT_FUNC_ARG_REF)
+            {
+                lattice[i].state = LAT_BOTTOM;
+            }
+            ForEachIROperand(values[i], [&](koopa_raw_value_t &operand)
+            {
+                int index = LocalIndex(operand);
+                if (index >= 0)
+                {
+                    users[index].push_back(i);
+                }
+            });
+        }
+        block_executable.assign(blocks.size(), false);
+        edge_executable.resize(blocks.size());
+        for (size_t b = 0; b < blocks.size(); b++)
+        {
+            ForEachSuccessor(blocks[b], [&](IRBasicBlock *, vector<const void *> &args)
+            {
+                for (size_t i = 0; i < args.size(); i++)
+                {
+                    int index = LocalIndex(reinterpret_cast<koopa_raw_value_t>(args[i]));
+                    if (index >= 0)
+                    {
+                        arg_users[index].push_back(arg_use_t{(int)b, (int)edge_executable[b].size(), (int)i});
+                    }
+                }
+                edge_executable[b].push_back(false);
+            });
+        }
+    }
+    // 本函数中已编号的值的下标, 整数常量, 全局变量等为 -1
+    int LocalIndex(koopa_raw_value_t value) const
+    {
+        switch (value->kind.tag)
+        {
+        case KOOPA_RVT_FUNC_ARG_REF:
+        case KOOPA_RVT_BLOCK_ARG_REF:
+        case KOOPA_RVT_BINARY:
+        case KOOPA_RVT_LOAD:
+        case KOOPA_RVT_CALL:
+            return ValueIndex(value);
+        default:
+            return -1;
+        }
+    }
+    lattice_t Get(koopa_raw_value_t value) const
+    {
+        if (value->kind.tag == KOOPA_RVT_INTEGER)
+        {
+            return lattice_t{LAT_CONST, value->kind.data.integer.value};
+        }
+        int index = LocalIndex(value);
+        return index >= 0 ? lattice[index] : lattice_t{LAT_BOTTOM, 0};
+    }
+    // 格只会下降: TOP -> 常量 -> BOTTOM, 两个不同的常量相遇得到 BOTTOM
+    void Lower(int index, lattice_t value)
+    {
+        lattice_t &cur = lattice[index];
+        if (value.state == LAT_TOP || cur.state == LAT_BOTTOM || (cur.state == LAT_CONST && value.state == LAT_CONST && cur.value == value.value))
+        {
+            return;
+        }
+        cur = (cur.state == LAT_TOP) ? value : lattice_t{LAT_BOTTOM, 0};
+        value_worklist.push_back(index);
+    }
+    const vector<const void *> &EdgeArgs(int block, int edge) const
+    {
+        const IRValue *last = AsIRValue(blocks[block]->inst_list.back());
+        return edge == 0 ? last->arg_list : last->false_arg_list;
+    }
+    void MarkEdge(int block, int edge)
+    {
+        if (!edge_executable[block][edge])
+        {
+            edge_executable[block][edge] = true;
+            edge_worklist.push_back(make_pair(block, edge));
+        }
+    }
+    // 块参数是所有可执行入边上实参的交汇. 格只会下降, 所以一条边变为可执行或者一个实参的值变化时,
+    // 只需要把参数与这个实参再求一次交汇
+    void VisitArg(const pair<int, int> &edge, int pos)
+    {
+        koopa_raw_value_t param = reinterpret_cast<koopa_raw_value_t>(TargetOf(edge)->param_list[pos]);
+        Lower(ValueIndex(param), Get(reinterpret_cast<koopa_raw_value_t>(EdgeArgs(edge.first, edge.second)[pos])));
+    }
+    void VisitInst(int index)
+    {
+        IRValue *inst = values[index];
+        const auto &kind = inst->kind;
+        switch (kind.tag)
+        {
+        case KOOPA_RVT_BINARY:
+        {
+            lattice_t lhs = Get(kind.data.binary.lhs);
+            lattice_t rhs = Get(kind.data.binary.rhs);
+            int32_t result;
+            bool has_zero = (lhs.state == LAT_CONST && lhs.value == 0) || (rhs.state == LAT_CONST && rhs.value == 0);
+            if ((kind.data.binary.op == KOOPA_RBO_MUL || kind.data.binary.op == KOOPA_RBO_AND) && has_zero)
+            {
+                Lower(index, lattice_t{LAT_CONST, 0});
+            }
+            else if (lhs.state == LAT_BOTTOM || rhs.state == LAT_BOTTOM)
+            {
+                Lower(index, lattice_t{LAT_BOTTOM, 0});
+            }
+            else if (lhs.state == LAT_CONST && rhs.state == LAT_CONST)
+            {
+                bool folded = FoldBinary(kind.data.binary.op, lhs.value, rhs.value, result);
+                Lower(index, folded ? lattice_t{LAT_CONST, result} : lattice_t{LAT_BOTTOM, 0});
+            }
+            break;
+        }
+        case KOOPA_RVT_LOAD:
+        case KOOPA_RVT_CALL:
+            Lower(index, lattice_t{LAT_BOTTOM, 0});
+            break;
+        case KOOPA_RVT_BRANCH:
+        {
+            lattice_t cond = Get(kind.data.branch.cond);
+            if (cond.state == LAT_CONST)
+            {
+                MarkEdge(value_block[index], cond.value != 0 ? 0 : 1);
+            }
+            else if (cond.state == LAT_BOTTOM)
+            {
+                MarkEdge(value_block[index], 0);
+                MarkEdge(value_block[index], 1);
+            }
+            break;
+        }
+        case KOOPA_RVT_JUMP:
+            MarkEdge(value_block[index], 0);
+            break;
+        default:
+            break;
+        }
+    }
+    void Propagate()
+    {
+        VisitBlock(0);
+        while (!edge_worklist.empty() || !value_worklist.empty())
+        {
+            while (!edge_worklist.empty())
+            {
+                pair<int, int> edge = edge_worklist.back();
+                edge_worklist.pop_back();
+                for (size_t i = 0; i < EdgeArgs(edge.first, edge.second).size(); i++)
+                {
+                    VisitArg(edge, i);
+                }
+                VisitBlock(TargetOf(edge)->index);
+            }
+            while (!value_worklist.empty() && edge_worklist.empty())
+            {
+                int index = value_worklist.back();
+                value_worklist.pop_back();
+                for (int user: users[index])
+                {
+                    int block = value_block[user];
+                    if (!block_executable[block])
+                    {
+                        continue;
+                    }
+                    VisitInst(user);
+                }
+                for (const arg_use_t &use: arg_users[index])
+                {
+                    if (edge_executable[use.block][use.edge])
+                    {
+                        VisitArg(make_pair(use.block, use.edge), use.pos);
+                    }
+                }
+            }
+        }
+    }
+    // 块第一次变为可执行时求值其中所有的指令
+    void VisitBlock(int block)
+    {
+        if (block_executable[block])
+        {
+            return;
+        }
+        block_executable[block] = true;
+        for (const void *inst: blocks[block]->inst_list)
+        {
+            VisitInst(ValueIndex(reinterpret_cast<koopa_raw_value_t>(inst)));
+        }
+    }
+    const IRBasicBlock *TargetOf(const pair<int, int> &edge) const
+    {
+        const IRValue *last = AsIRValue(blocks[edge.first]->inst_list.back());
+        if (last->kind.tag == KOOPA_RVT_JUMP)
+        {
+            return AsIRBlock(last->kind.data.jump.target);
+        }
+        return AsIRBlock(edge.second == 0 ? last->kind.data.branch.true_bb : last->kind.data.branch.false_bb);
+    }
+    // 常量值的使用换成整数常量, 常量的块参数和结果为常量的指令删除, 条件为常量的 br 改为 jump
+    bool Rewrite()
+    {
+        value_map_t replaced;
+        for (size_t i = 0; i < values.size(); i++)
+        {
+            if (lattice[i].state == LAT_CONST)
+            {
+                replaced[values[i]] = builder.Integer(lattice[i].value);
+            }
+        }
+        bool changed = !replaced.empty();
+        vector<vector<vector<const void *> *> > incoming = IncomingArgs(func);
+        for (IRBasicBlock *bb: blocks)
+        {
+            for (int i = (int)bb->param_list.size() - 1; i >= 0; i--)
+            {
+                if (lattice[AsIRValue(bb->param_list[i])->index].state == LAT_CONST)
+                {
+                    EraseBlockParam(bb, i, incoming[bb->index]);
+                }
+            }
+            vector<const void *> insts;
+            for (const void *ptr: bb->inst_list)
+            {
+                if (lattice[AsIRValue(ptr)->index].state != LAT_CONST)
+                {
+                    insts.push_back(ptr);
+                }
+            }
+            bb->inst_list.swap(insts);
+        }
+        ReplaceUses(func, replaced);
+        for (IRBasicBlock *bb: blocks)
+        {
+            IRValue *last = AsIRValue(bb->inst_list.back());
+            if (last->kind.tag != KOOPA_RVT_BRANCH || last->kind.data.branch.cond->kind.tag != KOOPA_RVT_INTEGER)
+            {
+                continue;
+            }
+            bool taken = last->kind.data.branch.cond->kind.data.integer.value != 0;
+            koopa_raw_basic_block_t target = taken ? last->kind.data.branch.true_bb : last->kind.data.branch.false_bb;
+            if (!taken)
+            {
+                last->arg_list.swap(last->false_arg_list);
+            }
+            last->false_arg_list.clear();
+            last->kind.tag = KOOPA_RVT_JUMP;
+            last->kind.data.jump.target = target;
+            changed = true;
+        }
+        changed |= RemoveUnreachableBlocks(func);
+        if (changed)
+        {
+            RemoveTrivialParams(builder, func);
+        }
+        return changed;
+    }
+public:
+    SCCP(IRBuilder &builder, IRFunction *func) : builder(builder), func(func)
+    {
+    }
+    bool Run()
+    {
+        NumberValues();
+        Propagate();
+        return Rewrite();
+    }
+};
+
+inline bool PropagateConstants(IRBuilder &builder, IRFunction *func)
+{
+    return SCCP(builder, func).Run();
+}
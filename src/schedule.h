@@ -0,0 +1,256 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+#include "mir.h"
+
+using namespace std;
+
+// 基本块内的表调度. 目标是顺序发射的 RV32IM 核, lw / mul / div 的结果没有准备好时后面用到它的指令要停顿,
+// 调度把与它无关的指令移到中间, 隐藏这段延迟.
+// call / tail / ret 和跳转指令把基本块分成若干段, 每段内部按依赖图独立调度, 这些指令本身保持原位.
+
+// 各种指令的结果延迟 (周期数), 按 MachineOp 的顺序排列, 换目标核时只需修改这张表
+static const int mop_latency[] = {
+    // add sub mul mulh div rem and or xor slt sgt
+    1, 1, 3, 3, 12, 12, 1, 1, 1, 1, 1,
+    // addi andi ori xori slti slli srli srai
+    1, 1, 1, 1, 1, 1, 1, 1,
+    // seqz snez mv
+    1, 1, 1,
+    // li
+    1,
+    // lui
+    1,
+    // lw sw
+    3, 1,
+    // bnez beqz beq bne blt bge j
+    1, 1, 1, 1, 1, 1, 1,
+    // call tail ret nop
+    1, 1, 1, 1};
+
+static_assert(sizeof(mop_latency) / sizeof(mop_latency[0]) == MOP_NOP + 1, "mop_latency must cover every MachineOp");
+
+// 寄存器分配之前调度时, 一条指令最多提前到原位置之前第 PRE_RA_SCHED_WINDOW 条, 以免把大量 lw 提到前面造成溢出
+#define PRE_RA_SCHED_WINDOW 8
+
+typedef struct
+{
+    int to;
+    int latency;
+} sched_edge_t;
+
+class ListScheduler
+{
+private:
+    MachineFunction &mf;
+    int window;
+    // 按寄存器编号记录本段中最后一次定值的指令和此后读取它的指令, 每段结束时只清除用到的寄存器
+    vector<int> last_def;
+    vector<vector<int> > uses_since_def;
+    vector<int> touched_regs;
+
+    static bool IsBarrier(const machine_inst_t &inst)
+    {
+        return inst.op == MOP_CALL || inst.op == MOP_TAIL || inst.op == MOP_RET || inst.target >= 0;
+    }
+    // 访存指令访问的位置. 栈帧对象和 sp 加偏移量的栈上地址与全局变量互不相交, 栈上地址按栈帧对象或偏移量区分;
+    // 全局变量的地址在寄存器中, 所有全局变量看作同一个位置
+    static int64_t MemoryKey(const machine_inst_t &inst)
+    {
+        if (inst.frame_index >= 0)
+        {
+            return inst.frame_index;
+        }
+        if (inst.rs1 == REG_SP)
+        {
+            return ((int64_t)1 << 32) + inst.imm;
+        }
+        return -1;
+    }
+    void ScheduleRegion(vector<machine_inst_t> &insts, size_t begin, size_t end)
+    {
+        int n = end - begin;
+        if (n < 2)
+        {
+            return;
+        }
+        // 依赖图: 写后读的边带上前一条指令的延迟, 读后写, 写后写和访存之间的边只保证先后顺序
+        vector<vector<sched_edge_t> > succs(n);
+        vector<int> pred_count(n, 0);
+        // 每个位置最后一条 sw 和此后的 lw
+        unordered_map<int64_t, pair<int, vector<int> > > mem_state;
+        vector<int> defs, uses;
+        auto add_edge = [&](int from, int to, int latency)
+        {
+            succs[from].push_back({to, latency});
+            pred_count[to]++;
+        };
+        for (int i = 0; i < n; i++)
+        {
+            const machine_inst_t &inst = insts[begin + i];
+            GetDefsUses(inst, defs, uses);
+            for (int use: uses)
+            {
+                if (last_def[use] >= 0)
+                {
+                    add_edge(last_def[use], i, mop_latency[insts[begin + last_def[use]].op]);
+                }
+            }
+            for (int def: defs)
+            {
+                if (last_def[def] >= 0)
+                {
+                    add_edge(last_def[def], i, 0);
+                }
+                for (int user: uses_since_def[def])
+                {
+                    if (user != i)
+                    {
+                        add_edge(user, i, 0);
+                    }
+                }
+            }
+            for (int use: uses)
+            {
+                uses_since_def[use].push_back(i);
+                touched_regs.push_back(use);
+            }
+            for (int def: defs)
+            {
+                last_def[def] = i;
+                uses_since_def[def].clear();
+                touched_regs.push_back(def);
+            }
+            if (inst.op == MOP_LW || inst.op == MOP_SW)
+            {
+                auto found = mem_state.emplace(MemoryKey(inst), make_pair(-1, vector<int>())).first;
+                pair<int, vector<int> > &state = found->second;
+                if (state.first >= 0)
+                {
+                    add_edge(state.first, i, 0);
+                }
+                if (inst.op == MOP_LW)
+                {
+                    state.second.push_back(i);
+                }
+                else
+                {
+                    for (int load: state.second)
+                    {
+                        add_edge(load, i, 0);
+                    }
+                    state.first = i;
+                    state.second.clear();
+                }
+            }
+        }
+        for (int reg: touched_regs)
+        {
+            last_def[reg] = -1;
+            uses_since_def[reg].clear();
+        }
+        touched_regs.clear();
+        // 优先级为到这一段末尾的最长延迟路径
+        vector<int> height(n, 0);
+        for (int i = n - 1; i >= 0; i--)
+        {
+            height[i] = mop_latency[insts[begin + i].op];
+            for (const sched_edge_t &edge: succs[i])
+            {
+                height[i] = max(height[i], edge.latency + height[edge.to]);
+            }
+        }
+        // 每个周期发射一条指令: 优先选已经可以发射的指令中优先级最高的, 没有时选最早可以发射的
+        vector<int> earliest(n, 0);
+        vector<int> ready;
+        for (int i = 0; i < n; i++)
+        {
+            if (pred_count[i] == 0)
+            {
+                ready.push_back(i);
+            }
+        }
+        vector<machine_inst_t> scheduled;
+        scheduled.reserve(n);
+        int cycle = 0;
+        while (!ready.empty())
+        {
+            // 原顺序中最靠前的未调度指令总是就绪的, 窗口内至少有一条候选
+            int limit = (int)scheduled.size() + window;
+            size_t best = ready.size();
+            for (size_t k = 0; k < ready.size(); k++)
+            {
+                int a = ready[k];
+                if (a >= limit)
+                {
+                    continue;
+                }
+                if (best == ready.size())
+                {
+                    best = k;
+                    continue;
+                }
+                int b = ready[best];
+                bool a_ready = earliest[a] <= cycle;
+                bool b_ready = earliest[b] <= cycle;
+                if (a_ready != b_ready)
+                {
+                    best = a_ready ? k : best;
+                }
+                else if (!a_ready && earliest[a] != earliest[b])
+                {
+                    best = (earliest[a] < earliest[b]) ? k : best;
+                }
+                else if (height[a] != height[b] ? height[a] > height[b] : a < b)
+                {
+                    best = k;
+                }
+            }
+            int i = ready[best];
+            ready.erase(ready.begin() + best);
+            cycle = max(cycle, earliest[i]);
+            scheduled.push_back(insts[begin + i]);
+            for (const sched_edge_t &edge: succs[i])
+            {
+                earliest[edge.to] = max(earliest[edge.to], cycle + edge.latency);
+                if (--pred_count[edge.to] == 0)
+                {
+                    ready.push_back(edge.to);
+                }
+            }
+            cycle++;
+        }
+        assert((int)scheduled.size() == n);
+        copy(scheduled.begin(), scheduled.end(), insts.begin() + begin);
+    }
+public:
+    ListScheduler(MachineFunction &mf, int window) : mf(mf), window(window)
+    {
+    }
+    void Run()
+    {
+        last_def.assign(VREG_BASE + mf.vreg_count, -1);
+        uses_since_def.assign(VREG_BASE + mf.vreg_count, vector<int>());
+        for (machine_block_t &block: mf.blocks)
+        {
+            size_t begin = 0;
+            for (size_t i = 0; i <= block.insts.size(); i++)
+            {
+                if (i == block.insts.size() || IsBarrier(block.insts[i]))
+                {
+                    ScheduleRegion(block.insts, begin, i);
+                    begin = i + 1;
+                }
+            }
+        }
+    }
+};
+
+// window 限制指令可以提前的距离, 寄存器分配之后调度不需要限制
+inline void ScheduleBlocks(MachineFunction &mf, int window = INT_MAX / 2)
+{
+    ListScheduler(mf, window).Run();
+}
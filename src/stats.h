@@ -0,0 +1,153 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <vector>
+#include <sys/resource.h>
+
+using namespace std;
+
+// 全局 operator new 的调用次数和字节数, 在 alloc_stats.cpp 中替换 operator new 时累加.
+// 计数是整个进程的, 批量模式下多个文件同时编译时各自的统计会互相混合.
+inline atomic<uint64_t> alloc_count(0);
+inline atomic<uint64_t> alloc_bytes(0);
+
+typedef struct
+{
+    const char *name;
+    double wall_ms;
+    double cpu_ms;
+    long peak_rss_kb;
+    uint64_t allocs;
+    uint64_t bytes;
+} phase_stat_t;
+
+// -time-passes / -mem-report: 记录每个阶段的墙钟时间, CPU 时间, 阶段结束时的峰值 RSS 以及分配次数
+class PhaseTimer
+{
+private:
+    vector<phase_stat_t> phases;
+    const char *cur_name = nullptr;
+    chrono::steady_clock::time_point start_wall;
+    double start_cpu = 0;
+    uint64_t start_allocs = 0;
+    uint64_t start_bytes = 0;
+
+    static double CpuMs()
+    {
+        timespec ts;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+    }
+    static long PeakRssKb()
+    {
+        rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        return usage.ru_maxrss;
+    }
+    // 输出 JSON 字符串字面量, 转义引号, 反斜杠和控制字符
+    static void PrintJsonString(FILE *out, const char *str)
+    {
+        fputc('"', out);
+        for (const char *p = str; *p != '\0'; p++)
+        {
+            unsigned char c = *p;
+            if (c == '"' || c == '\\')
+            {
+                fprintf(out, "\\%c", c);
+            }
+            else if (c < 0x20)
+            {
+                fprintf(out, "\\u%04x", c);
+            }
+            else
+            {
+                fputc(c, out);
+            }
+        }
+        fputc('"', out);
+    }
+public:
+    void Start(const char *name)
+    {
+        cur_name = name;
+        start_wall = chrono::steady_clock::now();
+        start_cpu = CpuMs();
+        start_allocs = alloc_count.load(memory_order_relaxed);
+        start_bytes = alloc_bytes.load(memory_order_relaxed);
+    }
+    void Stop()
+    {
+        phase_stat_t stat;
+        stat.name = cur_name;
+        stat.wall_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start_wall).count();
+        stat.cpu_ms = CpuMs() - start_cpu;
+        stat.peak_rss_kb = PeakRssKb();
+        stat.allocs = alloc_count.load(memory_order_relaxed) - start_allocs;
+        stat.bytes = alloc_bytes.load(memory_order_relaxed) - start_bytes;
+        phases.push_back(stat);
+        cur_name = nullptr;
+    }
+    void Report(FILE *out, const char *input, bool time_passes, bool mem_report, bool json) const
+    {
+        phase_stat_t total = {"total", 0, 0, 0, 0, 0};
+        for (const phase_stat_t &stat: phases)
+        {
+            total.wall_ms += stat.wall_ms;
+            total.cpu_ms += stat.cpu_ms;
+            total.peak_rss_kb = stat.peak_rss_kb;
+            total.allocs += stat.allocs;
+            total.bytes += stat.bytes;
+        }
+        vector<phase_stat_t> rows = phases;
+        rows.push_back(total);
+        if (json)
+        {
+            fprintf(out, "{\"input\": ");
+            PrintJsonString(out, input);
+            fprintf(out, ", \"phases\": [");
+            for (size_t i = 0; i < rows.size(); i++)
+            {
+                const phase_stat_t &stat = rows[i];
+                fprintf(out, "%s{\"name\": \"%s\"", i == 0 ? "" : ", ", stat.name);
+                if (time_passes)
+                {
+                    fprintf(out, ", \"wall_ms\": %.3f, \"cpu_ms\": %.3f", stat.wall_ms, stat.cpu_ms);
+                }
+                if (mem_report)
+                {
+                    fprintf(out, ", \"peak_rss_kb\": %ld, \"allocs\": %llu, \"alloc_bytes\": %llu", stat.peak_rss_kb, (unsigned long long)stat.allocs, (unsigned long long)stat.bytes);
+                }
+                fprintf(out, "}");
+            }
+            fprintf(out, "]}\n");
+            return;
+        }
+        fprintf(out, "===== Phase report: %s =====\n", input);
+        fprintf(out, "  %-14s", "phase");
+        if (time_passes)
+        {
+            fprintf(out, "%12s%12s", "wall(ms)", "cpu(ms)");
+        }
+        if (mem_report)
+        {
+            fprintf(out, "%14s%12s%14s", "peak_rss(KB)", "allocs", "alloc_bytes");
+        }
+        fprintf(out, "\n");
+        for (const phase_stat_t &stat: rows)
+        {
+            fprintf(out, "  %-14s", stat.name);
+            if (time_passes)
+            {
+                fprintf(out, "%12.3f%12.3f", stat.wall_ms, stat.cpu_ms);
+            }
+            if (mem_report)
+            {
+                fprintf(out, "%14ld%12llu%14llu", stat.peak_rss_kb, (unsigned long long)stat.allocs, (unsigned long long)stat.bytes);
+            }
+            fprintf(out, "\n");
+        }
+    }
+};
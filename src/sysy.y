@@ -1,41 +1,47 @@
 %code requires {
-    #include <memory>
-    #include <string>
     #include "ast.h"
+    typedef void *yyscan_t;
 }
 
 %{
 
 #include <iostream>
-#include <memory>
-#include <string>
 #include "ast.h"
 
-int yylex();
-void yyerror(std::unique_ptr<BaseAST> &ast, const char *s);
-
 using namespace std;
 
 %}
 
-%parse-param { std::unique_ptr<BaseAST> &ast }
+// 使用纯 (可重入) 的 parser 和 lexer, 所有状态都在 scanner 和 CompilationContext 中
+%define api.pure full
+%lex-param { yyscan_t scanner }
+%parse-param { yyscan_t scanner } { BaseAST *&ast }
 
 %union {
-    std::string *str_val;
+    symbol_id_t sym_val;
     int int_val;
+    char char_val;
+    koopa_raw_binary_op_t op_val;
     BaseAST *ast_val;
+    TypeAST *type_val;
     BaseExpAST *exp_val;
     VecAST *vec_val;
     ExpVecAST *exp_vec_val;
 }
 
-// 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 str_val 和 int_val
+%code {
+    int yylex(YYSTYPE *yylval, yyscan_t scanner);
+    void yyerror(yyscan_t scanner, BaseAST *&ast, const char *s);
+}
+
+// 注意 IDENT 和 INT_CONST 会返回 token 的值, 分别对应 sym_val (驻留后的标识符 id) 和 int_val
 %token INT VOID RETURN CONST IF ELSE WHILE BREAK CONTINUE
-%token <str_val> IDENT
+%token <sym_val> IDENT
 %token <int_val> INT_CONST
-%token <str_val> LE GE EQ NEQ AND OR
+%token LE GE EQ NEQ AND OR
 
-%type <ast_val> FuncDef Type Block Stmt
+%type <ast_val> FuncDef Block Stmt
+%type <type_val> Type
 %type <ast_val> Decl ConstDecl ConstDef BlockItem VarDef VarDecl
 %type <ast_val> OpenStmt ClosedStmt SimpleStmt
 %type <ast_val> FuncFParam
@@ -45,41 +51,42 @@ using namespace std;
 %type <vec_val> BlockItems ConstDefs VarDefs
 %type <vec_val> FuncFParams CompUnits
 %type <exp_vec_val> FuncRParams
-%type <str_val> UnaryOP MulOP AddOP RelOP EqOP
+%type <char_val> UnaryOP
+%type <op_val> MulOP AddOP RelOP EqOP
 %type <int_val> Number
 
 %%
 
 CompUnit
     : CompUnits {
-        auto comp_unit = make_unique<CompUnitAST>();
-        comp_unit->comp_units = unique_ptr<VecAST>($1);
-        ast = move(comp_unit);
+        auto comp_unit = ctx->ast_arena.New<CompUnitAST>();
+        comp_unit->comp_units = ($1);
+        ast = comp_unit;
     }
     ;
 
 CompUnits 
     : FuncDef {
-        auto comp_units = new VecAST();
-        auto func_def = unique_ptr<BaseAST>($1);
+        auto comp_units = ctx->ast_arena.New<VecAST>();
+        auto func_def = $1;
         comp_units->push_back(func_def);
         $$ = comp_units;
     }
     | Decl {
-        auto comp_units = new VecAST();
-        auto decl = unique_ptr<BaseAST>($1);
+        auto comp_units = ctx->ast_arena.New<VecAST>();
+        auto decl = $1;
         comp_units->push_back(decl);
         $$ = comp_units;
     }
     | CompUnits FuncDef {
         auto comp_units = ($1);
-        auto func_def = unique_ptr<BaseAST>($2);
+        auto func_def = $2;
         comp_units->push_back(func_def);
         $$ = comp_units;
     }
     | CompUnits Decl {
         auto comp_units = ($1);
-        auto decl = unique_ptr<BaseAST>($2);
+        auto decl = $2;
         comp_units->push_back(decl);
         $$ = comp_units;
     }
@@ -87,33 +94,33 @@ CompUnits
 
 FuncDef
     : Type IDENT '(' ')' Block {
-        auto funcdef = new FuncDefAST();
-        funcdef->func_type = unique_ptr<BaseAST>($1);
-        funcdef->ident = *unique_ptr<string>($2);
-        funcdef->block = unique_ptr<BaseAST>($5);
-        funcdef->func_fparams=unique_ptr<VecAST>(new VecAST());
+        auto funcdef = ctx->ast_arena.New<FuncDefAST>();
+        funcdef->func_type = $1;
+        funcdef->ident = $2;
+        funcdef->block = $5;
+        funcdef->func_fparams=ctx->ast_arena.New<VecAST>();
         $$ = funcdef;
     }
     | Type IDENT '(' FuncFParams ')' Block {
-        auto funcdef = new FuncDefAST();
-        funcdef->func_type = unique_ptr<BaseAST>($1);
-        funcdef->ident = *unique_ptr<string>($2);
-        funcdef->block = unique_ptr<BaseAST>($6);
-        funcdef->func_fparams=unique_ptr<VecAST>($4);
+        auto funcdef = ctx->ast_arena.New<FuncDefAST>();
+        funcdef->func_type = $1;
+        funcdef->ident = $2;
+        funcdef->block = $6;
+        funcdef->func_fparams=$4;
         $$ = funcdef;
     }
     ;
 
 FuncFParams
     : FuncFParam {
-        auto params = new VecAST();
-        auto func_fparam = unique_ptr<BaseAST>($1);
+        auto params = ctx->ast_arena.New<VecAST>();
+        auto func_fparam = $1;
         params->push_back(func_fparam);
         $$ = params;
     }
     | FuncFParams ',' FuncFParam {
         auto params = ($1);
-        auto func_fparam = unique_ptr<BaseAST>($3);
+        auto func_fparam = $3;
         params->push_back(func_fparam);
         $$ = params;
     }
@@ -121,35 +128,35 @@ FuncFParams
 
 FuncFParam
     : Type IDENT {
-        auto func_fparam = new FuncFParamAST();
-        func_fparam->btype = unique_ptr<BaseAST>($1);
-        func_fparam->ident = *unique_ptr<string>($2);
+        auto func_fparam = ctx->ast_arena.New<FuncFParamAST>();
+        func_fparam->btype = $1;
+        func_fparam->ident = $2;
         $$ = func_fparam;
     }
     ;
 
 Type
     : INT {
-        auto functype = new TypeAST();
-        functype->type = "int";
+        auto functype = ctx->ast_arena.New<TypeAST>();
+        functype->type = BType::BTYPE_INT;
         $$ = functype;
     }
     | VOID {
-        auto functype = new TypeAST();
-        functype->type = "void";
+        auto functype = ctx->ast_arena.New<TypeAST>();
+        functype->type = BType::BTYPE_VOID;
         $$ = functype;
     }
     ;
 
 Block
     : '{' BlockItems '}' {
-        auto block = new BlockAST();
-        block->items = unique_ptr<VecAST>($2);
+        auto block = ctx->ast_arena.New<BlockAST>();
+        block->items = $2;
         $$ = block;
     }
     | '{' '}' {
-        auto block = new BlockAST();
-        block->items = unique_ptr<VecAST>(new VecAST());
+        auto block = ctx->ast_arena.New<BlockAST>();
+        block->items = ctx->ast_arena.New<VecAST>();
         $$ = block;
     }
     ;
@@ -157,13 +164,13 @@ Block
 BlockItems
     : BlockItems BlockItem {
         auto items = ($1);
-        auto block_item = unique_ptr<BaseAST>($2);
+        auto block_item = $2;
         items->push_back(block_item);
         $$ = items;
     }
     | BlockItem {
-        auto items = new VecAST();
-        auto block_item = unique_ptr<BaseAST>($1);
+        auto items = ctx->ast_arena.New<VecAST>();
+        auto block_item = $1;
         items->push_back(block_item);
         $$ = items;
     }
@@ -171,14 +178,14 @@ BlockItems
 
 BlockItem
     : Decl {
-        auto block_item = new BlockItemAST();
-        block_item->decl = unique_ptr<BaseAST>($1);
+        auto block_item = ctx->ast_arena.New<BlockItemAST>();
+        block_item->decl = $1;
         block_item->type = BlockItemType::BLK_DECL;
         $$ = block_item;
     }
     | Stmt {
-        auto block_item = new BlockItemAST();
-        block_item->stmt = unique_ptr<BaseAST>($1);;
+        auto block_item = ctx->ast_arena.New<BlockItemAST>();
+        block_item->stmt = $1;
         block_item->type = BlockItemType::BLK_STMT;
         $$ = block_item;
     }
@@ -186,62 +193,62 @@ BlockItem
 
 Stmt
     : OpenStmt {
-        auto stmt = new StmtAST();
+        auto stmt = ctx->ast_arena.New<StmtAST>();
         stmt->type = StmtType::STMT_OPEN;
-        stmt->open_stmt = unique_ptr<BaseAST>($1);
+        stmt->open_stmt = $1;
         $$ = stmt;
     }
     | ClosedStmt {
-        auto stmt = new StmtAST();
+        auto stmt = ctx->ast_arena.New<StmtAST>();
         stmt->type = StmtType::STMT_CLOSED;
-        stmt->closed_stmt = unique_ptr<BaseAST>($1);
+        stmt->closed_stmt = $1;
         $$ = stmt;
     }
     ;
 
 SimpleStmt
     : RETURN Exp ';' {
-        auto stmt = new SimpleStmtAST();
+        auto stmt = ctx->ast_arena.New<SimpleStmtAST>();
         stmt->type = SimpleStmtType::SSTMT_RETURN;
-        stmt->exp = unique_ptr<BaseExpAST>($2);
+        stmt->exp = $2;
         $$ = stmt;
     }
     | LVal '=' Exp ';' {
-        auto stmt = new SimpleStmtAST();
+        auto stmt = ctx->ast_arena.New<SimpleStmtAST>();
         stmt->type = SimpleStmtType::SSTMT_ASSIGN;
-        stmt->lval = unique_ptr<BaseExpAST>($1);
-        stmt->exp = unique_ptr<BaseExpAST>($3);
+        stmt->lval = $1;
+        stmt->exp = $3;
         $$ = stmt;
     }
     | ';' {
-        auto stmt = new SimpleStmtAST();
+        auto stmt = ctx->ast_arena.New<SimpleStmtAST>();
         stmt->type = SimpleStmtType::SSTMT_EMPTY_EXP;
         $$ = stmt;
     }
     | Exp ';' {
-        auto stmt = new SimpleStmtAST();
+        auto stmt = ctx->ast_arena.New<SimpleStmtAST>();
         stmt->type = SimpleStmtType::SSTMT_EXP;
-        stmt->exp = unique_ptr<BaseExpAST>($1);
+        stmt->exp = $1;
         $$ = stmt;
     }
     | Block {
-        auto stmt = new SimpleStmtAST();
+        auto stmt = ctx->ast_arena.New<SimpleStmtAST>();
         stmt->type = SimpleStmtType::SSTMT_BLK;
-        stmt->block = unique_ptr<BaseAST>($1);
+        stmt->block = $1;
         $$ = stmt;
     }
     | RETURN ';' {
-        auto stmt = new SimpleStmtAST();
+        auto stmt = ctx->ast_arena.New<SimpleStmtAST>();
         stmt->type = SimpleStmtType::SSTMT_EMPTY_RET;
         $$ = stmt;
     }
     | BREAK ';' {
-        auto stmt = new SimpleStmtAST();
+        auto stmt = ctx->ast_arena.New<SimpleStmtAST>();
         stmt->type = SimpleStmtType::SSTMT_BREAK;
         $$ = stmt;
     }
     | CONTINUE ';' {
-        auto stmt = new SimpleStmtAST();
+        auto stmt = ctx->ast_arena.New<SimpleStmtAST>();
         stmt->type = SimpleStmtType::SSTMT_CONTINUE;
         $$ = stmt;
     }
@@ -249,28 +256,28 @@ SimpleStmt
 
 Exp
     : LOrExp {
-        auto exp = new ExpAST();
-        exp->exp = unique_ptr<BaseExpAST>($1);
+        auto exp = ctx->ast_arena.New<ExpAST>();
+        exp->exp = $1;
         $$=exp;
     }
     ;
 
 PrimaryExp
     : '(' Exp ')' {
-        auto primary_exp = new PrimaryExpAST();
+        auto primary_exp = ctx->ast_arena.New<PrimaryExpAST>();
         primary_exp->type = PrimaryExpType::EXP;
-        primary_exp->exp = unique_ptr<BaseExpAST>($2);
+        primary_exp->exp = $2;
         $$ = primary_exp;
     }
     | Number {
-        auto primary_exp = new PrimaryExpAST();
+        auto primary_exp = ctx->ast_arena.New<PrimaryExpAST>();
         primary_exp->type = PrimaryExpType::NUMBER;
         primary_exp->num = ($1);
         $$ = primary_exp;
     }
     | LVal {
-        auto primary_exp = new PrimaryExpAST();
-        primary_exp->lval = unique_ptr<BaseExpAST>($1);
+        auto primary_exp = ctx->ast_arena.New<PrimaryExpAST>();
+        primary_exp->lval = $1;
         primary_exp->type = PrimaryExpType::LVAL;
         $$ = primary_exp;
     }
@@ -278,29 +285,29 @@ PrimaryExp
 
 UnaryExp
     : PrimaryExp {
-        auto unary_exp = new UnaryExpAST();
+        auto unary_exp = ctx->ast_arena.New<UnaryExpAST>();
         unary_exp->type = UnaryExpType::PRIMARY;
-        unary_exp->primary_exp = unique_ptr<BaseExpAST>($1);
+        unary_exp->primary_exp = $1;
         $$ = unary_exp;
     }
     | UnaryOP UnaryExp {
-        auto unary_exp = new UnaryExpAST();
+        auto unary_exp = ctx->ast_arena.New<UnaryExpAST>();
         unary_exp->type = UnaryExpType::UNARY;
-        unary_exp->op = *unique_ptr<string>($1);
-        unary_exp->unary_exp = unique_ptr<BaseExpAST>($2);
+        unary_exp->op = $1;
+        unary_exp->unary_exp = $2;
         $$ = unary_exp;
     }
     | IDENT '(' ')' {
-        auto unary_exp = new UnaryExpAST();
-        unary_exp->func_name = *unique_ptr<string>($1);
-        unary_exp->func_rparams = unique_ptr<ExpVecAST>(new ExpVecAST());
+        auto unary_exp = ctx->ast_arena.New<UnaryExpAST>();
+        unary_exp->func_name = $1;
+        unary_exp->func_rparams = ctx->ast_arena.New<ExpVecAST>();
         unary_exp->type = UnaryExpType::CALL;
         $$ = unary_exp;
     }
     | IDENT '(' FuncRParams ')' {
-        auto unary_exp = new UnaryExpAST();
-        unary_exp->func_name = *unique_ptr<string>($1);
-        unary_exp->func_rparams = unique_ptr<ExpVecAST>($3);
+        auto unary_exp = ctx->ast_arena.New<UnaryExpAST>();
+        unary_exp->func_name = $1;
+        unary_exp->func_rparams = $3;
         unary_exp->type = UnaryExpType::CALL;
         $$ = unary_exp;
     }
@@ -309,13 +316,13 @@ UnaryExp
 FuncRParams
     : FuncRParams ',' Exp {
         auto params = ($1);
-        auto exp = unique_ptr<BaseExpAST>($3);
+        auto exp = $3;
         params->push_back(exp);
         $$ = params;
     }
     | Exp {
-        auto params = new ExpVecAST();
-        auto exp = unique_ptr<BaseExpAST>($1);
+        auto params = ctx->ast_arena.New<ExpVecAST>();
+        auto exp = $1;
         params->push_back(exp);
         $$ = params;
     }
@@ -323,172 +330,158 @@ FuncRParams
 
 MulExp
     : UnaryExp {
-        auto mul_exp = new MulExpAST();
+        auto mul_exp = ctx->ast_arena.New<MulExpAST>();
         mul_exp->type = BianryOPExpType::INHERIT;
-        mul_exp->unary_exp = unique_ptr<BaseExpAST>($1);
+        mul_exp->unary_exp = $1;
         $$ = mul_exp;
     }
     | MulExp MulOP UnaryExp {
-        auto mul_exp = new MulExpAST();
+        auto mul_exp = ctx->ast_arena.New<MulExpAST>();
         mul_exp->type = BianryOPExpType::EXPAND;
-        mul_exp->mul_exp = unique_ptr<BaseExpAST>($1);
-        mul_exp->op = *unique_ptr<string>($2);
-        mul_exp->unary_exp = unique_ptr<BaseExpAST>($3);
+        mul_exp->mul_exp = $1;
+        mul_exp->op = $2;
+        mul_exp->unary_exp = $3;
         $$ = mul_exp;
     }
     ;
 
 AddExp
     : MulExp {
-        auto add_exp = new AddExpAST();
+        auto add_exp = ctx->ast_arena.New<AddExpAST>();
         add_exp->type = BianryOPExpType::INHERIT;
-        add_exp->mul_exp = unique_ptr<BaseExpAST>($1);
+        add_exp->mul_exp = $1;
         $$ = add_exp;
     }
     | AddExp AddOP MulExp {
-        auto add_exp = new AddExpAST();
+        auto add_exp = ctx->ast_arena.New<AddExpAST>();
         add_exp->type = BianryOPExpType::EXPAND;
-        add_exp->add_exp = unique_ptr<BaseExpAST>($1);
-        add_exp->op = *unique_ptr<string>($2);
-        add_exp->mul_exp = unique_ptr<BaseExpAST>($3);
+        add_exp->add_exp = $1;
+        add_exp->op = $2;
+        add_exp->mul_exp = $3;
         $$ = add_exp;
     }
     ;
 
 RelExp
     : AddExp {
-        auto rel_exp = new RelExpAST();
+        auto rel_exp = ctx->ast_arena.New<RelExpAST>();
         rel_exp->type = BianryOPExpType::INHERIT;
-        rel_exp->add_exp = unique_ptr<BaseExpAST>($1);
+        rel_exp->add_exp = $1;
         $$ = rel_exp;
     }
     | RelExp RelOP AddExp {
-        auto rel_exp = new RelExpAST();
+        auto rel_exp = ctx->ast_arena.New<RelExpAST>();
         rel_exp->type = BianryOPExpType::EXPAND;
-        rel_exp->rel_exp = unique_ptr<BaseExpAST>($1);
-        rel_exp->op = *unique_ptr<string>($2);
-        rel_exp->add_exp = unique_ptr<BaseExpAST>($3);
+        rel_exp->rel_exp = $1;
+        rel_exp->op = $2;
+        rel_exp->add_exp = $3;
         $$ = rel_exp;
     }
     ;
 
 EqExp
     : RelExp {
-        auto eq_exp = new EqExpAST();
+        auto eq_exp = ctx->ast_arena.New<EqExpAST>();
         eq_exp->type = BianryOPExpType::INHERIT;
-        eq_exp->rel_exp = unique_ptr<BaseExpAST>($1);
+        eq_exp->rel_exp = $1;
         $$ = eq_exp;
     }
     | EqExp EqOP RelExp {
-        auto eq_exp = new EqExpAST();
+        auto eq_exp = ctx->ast_arena.New<EqExpAST>();
         eq_exp->type = BianryOPExpType::EXPAND;
-        eq_exp->eq_exp = unique_ptr<BaseExpAST>($1);
-        eq_exp->op = *unique_ptr<string>($2);
-        eq_exp->rel_exp = unique_ptr<BaseExpAST>($3);
+        eq_exp->eq_exp = $1;
+        eq_exp->op = $2;
+        eq_exp->rel_exp = $3;
         $$ = eq_exp;
     }
     ;
 
 LAndExp
     : EqExp {
-        auto land_exp = new LAndExpAST();
+        auto land_exp = ctx->ast_arena.New<LAndExpAST>();
         land_exp->type = BianryOPExpType::INHERIT;
-        land_exp->eq_exp = unique_ptr<BaseExpAST>($1);
+        land_exp->eq_exp = $1;
         $$ = land_exp;
     }
     | LAndExp AND EqExp {
-        auto land_exp = new LAndExpAST();
+        auto land_exp = ctx->ast_arena.New<LAndExpAST>();
         land_exp->type = BianryOPExpType::EXPAND;
-        land_exp->land_exp = unique_ptr<BaseExpAST>($1);
-        land_exp->eq_exp = unique_ptr<BaseExpAST>($3);
+        land_exp->land_exp = $1;
+        land_exp->eq_exp = $3;
         $$ = land_exp;
     }
     ;
 
 LOrExp
     : LAndExp {
-        auto lor_exp = new LOrExpAST();
+        auto lor_exp = ctx->ast_arena.New<LOrExpAST>();
         lor_exp->type = BianryOPExpType::INHERIT;
-        lor_exp->land_exp = unique_ptr<BaseExpAST>($1);
+        lor_exp->land_exp = $1;
         $$ = lor_exp;
     }
     | LOrExp OR LAndExp {
-        auto lor_exp = new LOrExpAST();
+        auto lor_exp = ctx->ast_arena.New<LOrExpAST>();
         lor_exp->type = BianryOPExpType::EXPAND;
-        lor_exp->lor_exp = unique_ptr<BaseExpAST>($1);
-        lor_exp->land_exp = unique_ptr<BaseExpAST>($3);
+        lor_exp->lor_exp = $1;
+        lor_exp->land_exp = $3;
         $$ = lor_exp;
     }
     ;
 
 UnaryOP
     : '+' {
-        string *op = new string("+");
-        $$ = op;
+        $$ = '+';
     }
     | '-' {
-        string *op = new string("-");
-        $$ = op;
+        $$ = '-';
     }
     | '!' {
-        string *op = new string("!");
-        $$ = op;
+        $$ = '!';
     }
     ;
 
 MulOP
     : '*' {
-        string *op = new string("*");
-        $$ = op;
+        $$ = KOOPA_RBO_MUL;
     }
     | '/' {
-        string *op = new string("/");
-        $$ = op;
+        $$ = KOOPA_RBO_DIV;
     }
     | '%' {
-        string *op = new string("%");
-        $$ = op;
+        $$ = KOOPA_RBO_MOD;
     }
     ;
 
 AddOP
     : '+' {
-        string *op = new string("+");
-        $$ = op;
+        $$ = KOOPA_RBO_ADD;
     }
     | '-' {
-        string *op = new string("-");
-        $$ = op;
+        $$ = KOOPA_RBO_SUB;
     }
     ;
 
 RelOP
     : '<' {
-        string *op = new string("<");
-        $$ = op;
+        $$ = KOOPA_RBO_LT;
     }
     | '>' {
-        string *op = new string(">");
-        $$ = op;
+        $$ = KOOPA_RBO_GT;
     }
     | LE {
-        string *op = new string("<=");
-        $$ = op;
+        $$ = KOOPA_RBO_LE;
     }
     | GE {
-        string *op = new string(">=");
-        $$ = op;
+        $$ = KOOPA_RBO_GE;
     }
     ;
 
 EqOP
     : EQ {
-        string *op = new string("==");
-        $$ = op;
+        $$ = KOOPA_RBO_EQ;
     }
     | NEQ {
-        string *op = new string("!=");
-        $$ = op;
+        $$ = KOOPA_RBO_NOT_EQ;
     }
     ;
 
@@ -500,38 +493,38 @@ Number
 
 Decl
     : ConstDecl {
-        auto decl = new DeclAST();
+        auto decl = ctx->ast_arena.New<DeclAST>();
         decl->type = DeclType::CONST_DECL;
-        decl->const_decl = unique_ptr<BaseAST>($1);
+        decl->const_decl = $1;
         $$ = decl;
     }
     | VarDecl {
-        auto decl = new DeclAST();
+        auto decl = ctx->ast_arena.New<DeclAST>();
         decl->type = DeclType::VAR_DECL;
-        decl->var_decl = unique_ptr<BaseAST>($1);
+        decl->var_decl = $1;
         $$ = decl;
     }
     ;
 
 ConstDecl
     : CONST Type ConstDefs ';' {
-        auto const_decl = new ConstDeclAST();
-        const_decl->btype = unique_ptr<BaseAST>($2);
-        const_decl->const_defs = unique_ptr<VecAST>($3);
+        auto const_decl = ctx->ast_arena.New<ConstDeclAST>();
+        const_decl->btype = $2;
+        const_decl->const_defs = $3;
         $$ = const_decl;
     }
     ;
 
 ConstDefs
     : ConstDef {
-        auto const_defs = new VecAST();
-        auto const_def = unique_ptr<BaseAST>($1);
+        auto const_defs = ctx->ast_arena.New<VecAST>();
+        auto const_def = $1;
         const_defs->push_back(const_def);
         $$ = const_defs;
     } 
     | ConstDefs ',' ConstDef {
         auto const_defs = $1;
-        auto const_def = unique_ptr<BaseAST>($3);
+        auto const_def = $3;
         const_defs->push_back(const_def);
         $$ = const_defs;
     }
@@ -539,56 +532,56 @@ ConstDefs
 
 ConstDef
     : IDENT '=' ConstInitVal {
-        auto const_def = new ConstDefAST();
-        const_def->ident = *unique_ptr<string>($1);
-        const_def->const_init_val = unique_ptr<BaseExpAST>($3);
+        auto const_def = ctx->ast_arena.New<ConstDefAST>();
+        const_def->ident = $1;
+        const_def->const_init_val = $3;
         $$ = const_def;
     }
     ;
 
 ConstInitVal
     : ConstExp {
-        auto const_init_val = new ConstInitValAST();
-        const_init_val->const_exp = unique_ptr<BaseExpAST>($1);
+        auto const_init_val = ctx->ast_arena.New<ConstInitValAST>();
+        const_init_val->const_exp = $1;
         $$ = const_init_val;
     }
     ;
 
 ConstExp
     : Exp {
-        auto const_exp = new ConstExpAST();
-        const_exp->exp = unique_ptr<BaseExpAST>($1);
+        auto const_exp = ctx->ast_arena.New<ConstExpAST>();
+        const_exp->exp = $1;
         $$ = const_exp;
     }
     ;
 
 LVal
     : IDENT {
-        auto lval = new LValAST();
-        lval->ident = *unique_ptr<string>($1);
+        auto lval = ctx->ast_arena.New<LValAST>();
+        lval->ident = $1;
         $$ = lval;
     }
     ;
 
 VarDecl
     : Type VarDefs ';' {
-        auto var_decl = new VarDeclAST();
-        var_decl->btype = unique_ptr<BaseAST>($1);
-        var_decl->var_defs = unique_ptr<VecAST>($2);
+        auto var_decl = ctx->ast_arena.New<VarDeclAST>();
+        var_decl->btype = $1;
+        var_decl->var_defs = $2;
         $$ = var_decl;
     }
     ;
 
 VarDefs
     : VarDef {
-        auto var_def = unique_ptr<BaseAST>($1);
-        auto var_defs = new VecAST();
+        auto var_def = $1;
+        auto var_defs = ctx->ast_arena.New<VecAST>();
         var_defs->push_back(var_def);
         $$ = var_defs;
     }
     | VarDefs ',' VarDef {
         auto var_defs = $1;
-        auto var_def = unique_ptr<BaseAST>($3);
+        auto var_def = $3;
         var_defs->push_back(var_def);
         $$ = var_defs;
     }
@@ -596,86 +589,86 @@ VarDefs
 
 VarDef
     : IDENT {
-        auto var_def = new VarDefAST();
+        auto var_def = ctx->ast_arena.New<VarDefAST>();
         var_def->type = VarDefType::VAR;
-        var_def->ident = *unique_ptr<string>($1);
+        var_def->ident = $1;
         $$ = var_def;
     }
     | IDENT '=' InitVal {
-        auto var_def = new VarDefAST();
+        auto var_def = ctx->ast_arena.New<VarDefAST>();
         var_def->type = VarDefType::VAR_ASSIGN;
-        var_def->ident = *unique_ptr<string>($1);
-        var_def->init_val = unique_ptr<BaseExpAST>($3);
+        var_def->ident = $1;
+        var_def->init_val = $3;
         $$ = var_def;
     }
     ;
 
 InitVal
     : Exp {
-        auto init_val = new InitValAST();
-        init_val->exp = unique_ptr<BaseExpAST>($1);
+        auto init_val = ctx->ast_arena.New<InitValAST>();
+        init_val->exp = $1;
         $$ = init_val;
     }
     ;
 
 OpenStmt
     : IF '(' Exp ')' ClosedStmt {
-        auto open_stmt = new OpenStmtAST();
+        auto open_stmt = ctx->ast_arena.New<OpenStmtAST>();
         open_stmt->type = OpenStmtType::OSTMT_CLOSED;
-        open_stmt->exp = unique_ptr<BaseExpAST>($3);
-        open_stmt->closed_stmt = unique_ptr<BaseAST>($5);
+        open_stmt->exp = $3;
+        open_stmt->closed_stmt = $5;
         $$ = open_stmt;
     }
     | IF '(' Exp ')' OpenStmt {
-        auto open_stmt = new OpenStmtAST();
+        auto open_stmt = ctx->ast_arena.New<OpenStmtAST>();
         open_stmt->type = OpenStmtType::OSTMT_OPEN;
-        open_stmt->exp = unique_ptr<BaseExpAST>($3);
-        open_stmt->open_stmt = unique_ptr<BaseAST>($5);
+        open_stmt->exp = $3;
+        open_stmt->open_stmt = $5;
         $$ = open_stmt;
     }
     | IF '(' Exp ')' ClosedStmt ELSE OpenStmt{
-        auto open_stmt = new OpenStmtAST();
+        auto open_stmt = ctx->ast_arena.New<OpenStmtAST>();
         open_stmt->type = OpenStmtType::OSTMT_ELSE;
-        open_stmt->exp = unique_ptr<BaseExpAST>($3);
-        open_stmt->closed_stmt = unique_ptr<BaseAST>($5);
-        open_stmt->open_stmt = unique_ptr<BaseAST>($7);
+        open_stmt->exp = $3;
+        open_stmt->closed_stmt = $5;
+        open_stmt->open_stmt = $7;
         $$ = open_stmt;
     }
     | WHILE '(' Exp ')' OpenStmt {
-        auto open_stmt = new OpenStmtAST();
+        auto open_stmt = ctx->ast_arena.New<OpenStmtAST>();
         open_stmt->type = OpenStmtType::OSTMT_WHILE;
-        open_stmt->exp = unique_ptr<BaseExpAST>($3);
-        open_stmt->open_stmt = unique_ptr<BaseAST>($5);
+        open_stmt->exp = $3;
+        open_stmt->open_stmt = $5;
         $$ = open_stmt;
     }
     ;
 
 ClosedStmt
     : SimpleStmt {
-        auto closed_stmt = new ClosedStmtAST();
+        auto closed_stmt = ctx->ast_arena.New<ClosedStmtAST>();
         closed_stmt->type = ClosedStmtType::CSTMT_SIMPLE;
-        closed_stmt->simple_stmt = unique_ptr<BaseAST>($1);
+        closed_stmt->simple_stmt = $1;
         $$ = closed_stmt;
     }
     | IF '(' Exp ')' ClosedStmt ELSE ClosedStmt {
-        auto closed_stmt = new ClosedStmtAST();
+        auto closed_stmt = ctx->ast_arena.New<ClosedStmtAST>();
         closed_stmt->type = ClosedStmtType::CSTMT_ELSE;
-        closed_stmt->exp = unique_ptr<BaseExpAST>($3);
-        closed_stmt->closed_stmt1 = unique_ptr<BaseAST>($5);
-        closed_stmt->closed_stmt2 = unique_ptr<BaseAST>($7);
+        closed_stmt->exp = $3;
+        closed_stmt->closed_stmt1 = $5;
+        closed_stmt->closed_stmt2 = $7;
         $$ = closed_stmt;
     }
     | WHILE '(' Exp ')' ClosedStmt {
-        auto closed_stmt = new ClosedStmtAST();
+        auto closed_stmt = ctx->ast_arena.New<ClosedStmtAST>();
         closed_stmt->type = ClosedStmtType::CSTMT_WHILE;
-        closed_stmt->exp = unique_ptr<BaseExpAST>($3);
-        closed_stmt->closed_stmt1 = unique_ptr<BaseAST>($5);
+        closed_stmt->exp = $3;
+        closed_stmt->closed_stmt1 = $5;
         $$ = closed_stmt;
     }
     ;
 
 %%
 
-void yyerror(unique_ptr<BaseAST> &ast, const char *s) {
+void yyerror(yyscan_t scanner, BaseAST *&ast, const char *s) {
     cerr << "error: " << s << endl;
 }
\ No newline at end of file
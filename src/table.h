@@ -1,176 +1,168 @@
 #pragma once
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
+#include "arena.h"
+#include "koopa.h"
 
 using namespace std;
 
-enum SYMBOL_TYPE{CONST_SYMBOL, VAR_SYMBOL};
-typedef struct
-{
-    SYMBOL_TYPE type;
-    int value;
-    string ir_name;
-} symbol_info_t;
+// 标识符在词法分析时就被驻留为整数 id, 之后的符号表和函数表都以 id 为键, 不再哈希和拷贝字符串
+typedef uint32_t symbol_id_t;
 
-class SymbolTable
+class SymbolPool
 {
 private:
-    int stack_depth;
-    int id;
-    int child_count;
-    string name;
-    SymbolTable *parent;
-    SymbolTable *child;
-    unordered_map<string, symbol_info_t*> symbol_table;
+    Arena arena;
+    vector<const char *> names;
+    unordered_map<string_view, symbol_id_t> ids;
 public:
-    SymbolTable()
+    symbol_id_t Intern(const char *str, size_t len)
     {
-        stack_depth = 0;
-        id = 0;
-        child_count = 0;
-        name = "";
-        parent = nullptr;
-        child = nullptr;
+        auto it = ids.find(string_view(str, len));
+        if (it != ids.end())
+        {
+            return it->second;
+        }
+        char *copy = static_cast<char *>(arena.Allocate(len + 1, 1));
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+        symbol_id_t id = names.size();
+        names.push_back(copy);
+        ids.emplace(string_view(copy, len), id);
+        return id;
     }
-    SymbolTable(int depth, int id) : stack_depth(depth), id(id), child_count(0)
+    symbol_id_t Intern(const char *str)
     {
+        return Intern(str, strlen(str));
     }
-    inline bool Exist(string symbol);
-    inline string Insert(string symbol, int value);
-    inline string Insert(string symbol, string ir_name);
-    inline symbol_info_t *LookUp(string symbol);
-    inline SymbolTable *PopScope();
-    inline SymbolTable *PushScope();
-    ~SymbolTable()
+    const char *Name(symbol_id_t id) const
     {
-        for (auto &item: symbol_table)
-        {
-            delete item.second;
-        }
-        symbol_table.clear();
+        return names[id];
     }
 };
 
+enum SYMBOL_TYPE{CONST_SYMBOL, VAR_SYMBOL};
+typedef struct
+{
+    SYMBOL_TYPE type;
+    int value;
+    string ir_name;
+    koopa_raw_value_t ir_value;
+    size_t depth;
+} symbol_info_t;
+
+// 作用域的名字是从最外层到它的各级序号连成的后缀 (例如 "_0_2"), 只在插入变量时才拼出来
+typedef struct
+{
+    int index;
+    int child_count;
+    size_t undo_start;
+    size_t name_end;
+} scope_info_t;
+
+// 扁平的作用域符号表: 每个符号 id 对应一个绑定栈, 栈顶是当前可见的定义;
+// undo_log 按顺序记录每个作用域中插入的符号, 退出作用域时据此弹出对应的绑定.
+// symbol_info_t 统一放在 deque 中, 插入和退出作用域时只在尾部增删, 已有记录的地址保持不变.
 class SymbolTableStack
 {
 private:
-    SymbolTable *current_symtab;
-public:
-    SymbolTableStack()
-    {
-        current_symtab = new SymbolTable();
-    }
-    bool Exist(string symbol)
-    {
-        return current_symtab->Exist(symbol);
-    }
-    string Insert(string symbol, int value)
-    {
-        return current_symtab->Insert(symbol, value);
-    }
-    string Insert(string symbol, string ir_name)
+    vector<vector<symbol_info_t *> > bindings;
+    vector<symbol_id_t> undo_log;
+    vector<scope_info_t> scopes;
+    deque<symbol_info_t> infos;
+    // scopes 中前 named_depth 个作用域的名字已经拼好, 第 i 个的名字是 scope_name 的前 name_end 个字符
+    string scope_name;
+    size_t named_depth = 1;
+
+    symbol_info_t *NewBinding(symbol_id_t symbol)
     {
-        return current_symtab->Insert(symbol, ir_name);
+        if (symbol >= bindings.size())
+        {
+            bindings.resize(symbol + 1);
+        }
+        infos.emplace_back();
+        symbol_info_t *info = &infos.back();
+        info->depth = scopes.size();
+        bindings[symbol].push_back(info);
+        undo_log.push_back(symbol);
+        return info;
     }
-    symbol_info_t *LookUp(string symbol)
+    const string &ScopeName()
     {
-        return current_symtab->LookUp(symbol);
+        for (; named_depth < scopes.size(); named_depth++)
+        {
+            scope_name += '_';
+            scope_name += to_string(scopes[named_depth].index);
+            scopes[named_depth].name_end = scope_name.size();
+        }
+        return scope_name;
     }
-    void PopScope()
+public:
+    SymbolTableStack()
     {
-        SymbolTable *old = current_symtab;
-        current_symtab = current_symtab->PopScope();
-        delete old;
+        scopes.push_back({0, 0, 0, 0});
     }
-    void PushScope()
+    bool Exist(symbol_id_t symbol)
     {
-        current_symtab = current_symtab->PushScope();
+        return symbol < bindings.size() && !bindings[symbol].empty() && bindings[symbol].back()->depth == scopes.size();
     }
-};
-
-inline SymbolTableStack symbol_table_stack;
-inline unordered_map<string, string> func_map;
-
-bool SymbolTable::Exist(string symbol)
-{
-    return (symbol_table.find(symbol) != symbol_table.end());
-}
-
-string SymbolTable::Insert(string symbol, int value)
-{
-    if (Exist(symbol))
+    string Insert(symbol_id_t symbol, int value)
     {
+        if (Exist(symbol))
+        {
+            return "";
+        }
+        symbol_info_t *info = NewBinding(symbol);
+        info->value = value;
+        info->type = SYMBOL_TYPE::CONST_SYMBOL;
         return "";
     }
-    symbol_info_t *info = new symbol_info_t;
-    info->value = value;
-    info->type = SYMBOL_TYPE::CONST_SYMBOL;
-    this->symbol_table[symbol] = info;
-    return "";
-}
-
-string SymbolTable::Insert(string symbol, string ir_name)
-{
-    if (Exist(symbol))
+    string Insert(symbol_id_t symbol, string ir_name)
     {
-        return "";
+        if (Exist(symbol))
+        {
+            return "";
+        }
+        symbol_info_t *info = NewBinding(symbol);
+        info->type = SYMBOL_TYPE::VAR_SYMBOL;
+        info->ir_name = ir_name + ScopeName();
+        return info->ir_name;
     }
-    symbol_info_t *info = new symbol_info_t;
-    info->type = SYMBOL_TYPE::VAR_SYMBOL;
-    info->ir_name = ir_name + name;
-    this->symbol_table[symbol] = info;
-    return info->ir_name;
-}
-
-symbol_info_t *SymbolTable::LookUp(string symbol)
-{
-    if (Exist(symbol))
+    symbol_info_t *LookUp(symbol_id_t symbol)
     {
-        return symbol_table[symbol];
+        if (symbol >= bindings.size() || bindings[symbol].empty())
+        {
+            return nullptr;
+        }
+        return bindings[symbol].back();
     }
-    if (parent != nullptr)
+    void PushScope()
     {
-        return parent->LookUp(symbol);
+        int index = scopes.back().child_count++;
+        scopes.push_back({index, 0, undo_log.size(), 0});
     }
-    else
+    void PopScope()
     {
-        return nullptr;
+        assert(scopes.size() > 1);
+        size_t undo_start = scopes.back().undo_start;
+        while (undo_log.size() > undo_start)
+        {
+            bindings[undo_log.back()].pop_back();
+            undo_log.pop_back();
+            infos.pop_back();
+        }
+        scopes.pop_back();
+        if (named_depth > scopes.size())
+        {
+            named_depth = scopes.size();
+            scope_name.resize(scopes.back().name_end);
+        }
     }
-}
-
-SymbolTable *SymbolTable::PushScope()
-{
-    SymbolTable *sym_tab = new SymbolTable(stack_depth + 1, child_count++);
-    sym_tab->name = name + "_" + to_string(sym_tab->id);
-    sym_tab->parent = this;
-    sym_tab->child = nullptr;
-    this->child = sym_tab;
-    return sym_tab;
-}
-
-SymbolTable *SymbolTable::PopScope()
-{
-    SymbolTable *sym_tab = this->parent;
-    return sym_tab;
-}
-
-inline void initSysyRuntimeLib()
-{
-    func_map["getint"] = "i32";
-    func_map["getch"] = "i32";
-    func_map["getarray"] = "i32";
-    func_map["putint"] = "void";
-    func_map["putch"] = "void";
-    func_map["putarray"] = "void";
-    func_map["starttime"] = "void";
-    func_map["stoptime"] = "void";
-    cout << "decl @getint(): i32" << endl;
-    cout << "decl @getch(): i32" << endl;
-    cout << "decl @getarray(*i32): i32" << endl;
-    cout << "decl @putint(i32)" << endl;
-    cout << "decl @putch(i32)" << endl;
-    cout << "decl @putarray(i32, *i32)" << endl;
-    cout << "decl @starttime()" << endl;
-    cout << "decl @stoptime()" << endl;
-}
\ No newline at end of file
+};
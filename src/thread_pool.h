@@ -0,0 +1,40 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// 固定数量的工作线程从共享计数器中领取任务编号, 直到 n 个任务全部完成. 调用 Run 的线程也参与执行.
+class ThreadPool
+{
+private:
+    unsigned jobs;
+public:
+    explicit ThreadPool(unsigned jobs) : jobs(max(jobs, 1u))
+    {
+    }
+    void Run(size_t n, const function<void(size_t)> &task)
+    {
+        atomic<size_t> next(0);
+        auto worker = [&]()
+        {
+            for (size_t i = next++; i < n; i = next++)
+            {
+                task(i);
+            }
+        };
+        vector<thread> threads;
+        for (unsigned i = 1; i < jobs && i < n; i++)
+        {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto &t: threads)
+        {
+            t.join();
+        }
+    }
+};